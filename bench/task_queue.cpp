@@ -0,0 +1,171 @@
+/*
+ * Measures how many tasks per second get through the loop's task queue with 1 to 64 producer threads.
+ *
+ * "queue" pushes preallocated nodes straight into a detail::TaskQueue drained by a single consumer thread, so it
+ * measures nothing but the queue itself. "post" goes through Loop::post onto a loop running run_forever, which
+ * includes allocating each task and ringing the doorbell.
+ *
+ * Usage: bench_task_queue [tasks per run]
+ * */
+
+#include <uv++/loop.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace {
+    typedef std::chrono::steady_clock clock_type;
+
+    struct CountedTask : public uv::detail::TaskNode {
+        size_t *counter;
+
+        CountedTask() {
+            this->run = &CountedTask::run_once;
+        }
+
+        static void run_once( uv::detail::TaskNode *n ) noexcept {
+            ++*static_cast<CountedTask *>(n)->counter;
+        }
+    };
+
+    double bench_queue( size_t producers, size_t tasks ) {
+        const size_t per_producer = tasks / producers;
+        const size_t total        = per_producer * producers;
+
+        uv::detail::TaskQueue queue;
+
+        size_t ran = 0;
+
+        std::vector<std::vector<CountedTask>> nodes( producers, std::vector<CountedTask>( per_producer ));
+
+        for( auto &v : nodes ) {
+            for( auto &n : v ) {
+                n.counter = &ran;
+            }
+        }
+
+        std::atomic_bool go( false );
+
+        std::vector<std::thread> threads;
+
+        for( size_t i = 0; i < producers; ++i ) {
+            threads.emplace_back( [&, i] {
+                while( !go.load( std::memory_order_acquire )) {
+                    std::this_thread::yield();
+                }
+
+                for( auto &n : nodes[i] ) {
+                    queue.push( &n );
+                }
+            } );
+        }
+
+        auto start = clock_type::now();
+
+        go.store( true, std::memory_order_release );
+
+        while( ran < total ) {
+            uv::detail::TaskNode *task = queue.take_all();
+
+            while( task != nullptr ) {
+                uv::detail::TaskNode *next = task->next;
+
+                task->run( task );
+
+                task = next;
+            }
+        }
+
+        auto elapsed = clock_type::now() - start;
+
+        for( auto &t : threads ) {
+            t.join();
+        }
+
+        return total / std::chrono::duration<double>( elapsed ).count();
+    }
+
+    double bench_post( size_t producers, size_t tasks ) {
+        const size_t per_producer = tasks / producers;
+
+        /*
+         * The uv_loop_t is owned here rather than by the Loop, so nothing is left for ~Loop to tear down off the loop
+         * thread. The loop thread closes it once run_forever returns.
+         * */
+        uv_loop_t raw;
+
+        uv_loop_init( &raw );
+
+        auto loop = uv::Loop::make_loop( &raw );
+
+        std::thread loop_thread( [loop] {
+            loop->run_forever();
+
+            loop->close();
+        } );
+
+        //Only ever touched on the loop thread
+        size_t ran = 0;
+
+        std::promise<void> done;
+
+        std::atomic_bool go( false );
+
+        std::vector<std::thread> threads;
+
+        for( size_t i = 0; i < producers; ++i ) {
+            threads.emplace_back( [&] {
+                while( !go.load( std::memory_order_acquire )) {
+                    std::this_thread::yield();
+                }
+
+                for( size_t j = 0; j < per_producer; ++j ) {
+                    loop->post( [&ran] {
+                        ++ran;
+                    } );
+                }
+            } );
+        }
+
+        auto start = clock_type::now();
+
+        go.store( true, std::memory_order_release );
+
+        for( auto &t : threads ) {
+            t.join();
+        }
+
+        //Pushed after every producer is done, so it runs last
+        loop->post( [&] {
+            done.set_value();
+
+            loop->stop();
+        } );
+
+        done.get_future().wait();
+
+        auto elapsed = clock_type::now() - start;
+
+        loop_thread.join();
+
+        return ran / std::chrono::duration<double>( elapsed ).count();
+    }
+}
+
+int main( int argc, char **argv ) {
+    const size_t tasks = argc > 1 ? std::strtoull( argv[1], nullptr, 10 ) : 4000000;
+
+    std::printf( "%10s %16s %16s\n", "producers", "queue tasks/s", "post tasks/s" );
+
+    for( size_t producers = 1; producers <= 64; producers *= 2 ) {
+        std::printf( "%10zu %16.0f %16.0f\n", producers, bench_queue( producers, tasks ),
+                     bench_post( producers, tasks ));
+    }
+
+    return 0;
+}
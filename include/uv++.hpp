@@ -6,6 +6,11 @@
 #define UV_UV_HPP
 
 #include "uv++/loop.hpp"
+#include "uv++/loop_group.hpp"
+#include "uv++/channel.hpp"
+#include "uv++/strand.hpp"
+#include "uv++/watchdog.hpp"
+#include "uv++/prefork.hpp"
 #include "uv++/os.hpp"
 #include "uv++/net.hpp"
 #include "uv++/misc.hpp"
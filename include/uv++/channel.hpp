@@ -0,0 +1,221 @@
+#ifndef UV_CHANNEL_HPP
+#define UV_CHANNEL_HPP
+
+#include "loop.hpp"
+
+#include <functional>
+
+namespace uv {
+    /*
+     * Bounded single-producer/single-consumer channel into a loop.
+     *
+     * Exactly one thread, usually another loop, sends messages, and the handler gets each one on the consumer loop's
+     * thread in the order they were sent. Sending is just a write into a ring buffer, so there is no allocation and
+     * no future involved.
+     *
+     * The consumer only gets woken up once per batch. While a drain is queued or running, sends don't touch the
+     * consumer's task queue at all, so a busy pipeline of loops costs a wakeup per batch instead of per message.
+     *
+     * The producer and consumer indices live on separate cache lines, and each side keeps a cached copy of the
+     * other's index so it only has to look at the shared one when the ring seems full or empty.
+     *
+     * There is nowhere for exceptions thrown by the handler to go, so don't.
+     * */
+    template <typename T>
+    class Channel final : public std::enable_shared_from_this<Channel<T>>, private detail::TaskNode {
+        public:
+            typedef T                          value_type;
+            typedef std::function<void( T && )> handler_t;
+
+        private:
+            typedef typename std::aligned_storage<sizeof( T ), alignof( T )>::type slot_t;
+
+            std::shared_ptr<Loop> consumer;
+            handler_t             handler;
+
+            const size_t              mask;
+            std::unique_ptr<slot_t[]> slots;
+
+            //Keeps the channel alive while a drain is queued on the consumer loop
+            std::shared_ptr<Channel> queued_self;
+
+            char pad0[UV_CACHE_LINE_SIZE];
+
+            //Consumer side
+            std::atomic_size_t head;
+            size_t             cached_tail;
+
+            char pad1[UV_CACHE_LINE_SIZE];
+
+            //Producer side
+            std::atomic_size_t tail;
+            size_t             cached_head;
+
+            char pad2[UV_CACHE_LINE_SIZE];
+
+            //Whether a drain is queued or running on the consumer loop
+            std::atomic_bool scheduled;
+
+            char pad3[UV_CACHE_LINE_SIZE];
+
+            static size_t round_capacity( size_t capacity ) noexcept {
+                size_t c = 1;
+
+                while( c < capacity ) {
+                    c <<= 1;
+                }
+
+                return c;
+            }
+
+            inline T *slot( size_t i ) noexcept {
+                return reinterpret_cast<T *>(&this->slots[i & this->mask]);
+            }
+
+            inline void notify() noexcept {
+                //Pairs with the fence in drain, so either the consumer sees the new message or we see it has stopped
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                if( !this->scheduled.load( std::memory_order_relaxed ) && !this->scheduled.exchange( true )) {
+                    this->queued_self = this->shared_from_this();
+
+                    this->consumer->enqueue( Loop::priority::NORMAL, this );
+                }
+            }
+
+            static void run_drain( detail::TaskNode *n ) noexcept {
+                Channel *c = static_cast<Channel *>(n);
+
+                std::shared_ptr<Channel> self = std::move( c->queued_self );
+
+                c->drain( self );
+            }
+
+            //Runs at most one ring's worth of messages per pass, so a fast producer can't hog the consumer loop
+            void drain( std::shared_ptr<Channel> &self ) noexcept {
+                size_t h      = this->head.load( std::memory_order_relaxed );
+                size_t budget = this->mask + 1;
+
+                for( ;; ) {
+                    if( h == this->cached_tail ) {
+                        this->cached_tail = this->tail.load( std::memory_order_acquire );
+                    }
+
+                    while( h != this->cached_tail && budget > 0 ) {
+                        T *value = this->slot( h );
+
+                        this->handler( std::move( *value ));
+
+                        value->~T();
+
+                        this->head.store( ++h, std::memory_order_release );
+
+                        --budget;
+                    }
+
+                    if( budget == 0 ) {
+                        //Still scheduled, so nobody else will queue us
+                        this->queued_self = std::move( self );
+
+                        this->consumer->enqueue( Loop::priority::NORMAL, this );
+
+                        return;
+                    }
+
+                    this->scheduled.store( false );
+
+                    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                    this->cached_tail = this->tail.load( std::memory_order_acquire );
+
+                    if( h == this->cached_tail || this->scheduled.exchange( true )) {
+                        return;
+                    }
+                }
+            }
+
+            Channel( std::shared_ptr<Loop> l, size_t capacity, handler_t h )
+                : consumer( std::move( l )),
+                  handler( std::move( h )),
+                  mask( round_capacity( capacity ) - 1 ),
+                  slots( new slot_t[round_capacity( capacity )] ),
+                  head( 0 ),
+                  cached_tail( 0 ),
+                  tail( 0 ),
+                  cached_head( 0 ),
+                  scheduled( false ) {
+                this->run = &Channel::run_drain;
+            }
+
+        public:
+            Channel( const Channel & ) = delete;
+
+            //Capacity is rounded up to a power of two
+            static std::shared_ptr<Channel> make( std::shared_ptr<Loop> consumer, size_t capacity, handler_t handler ) {
+                if( capacity == 0 ) {
+                    throw ::uv::Exception( "Channel capacity must be at least one" );
+                }
+
+                return std::shared_ptr<Channel>( new Channel( std::move( consumer ), capacity, std::move( handler )));
+            }
+
+            /*
+             * Producer only. Returns false without doing anything if the channel is full.
+             * */
+            template <typename... Args>
+            bool try_emplace( Args &&... args ) {
+                size_t t = this->tail.load( std::memory_order_relaxed );
+
+                if( t - this->cached_head > this->mask ) {
+                    this->cached_head = this->head.load( std::memory_order_acquire );
+
+                    if( t - this->cached_head > this->mask ) {
+                        return false;
+                    }
+                }
+
+                new( this->slot( t )) T( std::forward<Args>( args )... );
+
+                this->tail.store( t + 1, std::memory_order_release );
+
+                this->notify();
+
+                return true;
+            }
+
+            inline bool try_send( const T &value ) {
+                return this->try_emplace( value );
+            }
+
+            inline bool try_send( T &&value ) {
+                return this->try_emplace( std::move( value ));
+            }
+
+            inline std::shared_ptr<Loop> loop() const noexcept {
+                return this->consumer;
+            }
+
+            inline size_t capacity() const noexcept {
+                return this->mask + 1;
+            }
+
+            //Only exact from the producer or consumer while the other side isn't doing anything
+            inline size_t size() const noexcept {
+                return this->tail.load( std::memory_order_acquire ) - this->head.load( std::memory_order_acquire );
+            }
+
+            inline bool empty() const noexcept {
+                return this->size() == 0;
+            }
+
+            ~Channel() {
+                size_t t = this->tail.load( std::memory_order_acquire );
+
+                for( size_t h = this->head.load( std::memory_order_relaxed ); h != t; ++h ) {
+                    this->slot( h )->~T();
+                }
+            }
+    };
+}
+
+#endif //UV_CHANNEL_HPP
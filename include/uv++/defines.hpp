@@ -25,10 +25,8 @@
 # define UV_WRITE_BUFFER_SIZE 16384 //16k
 #endif
 
-#ifdef UV_USE_BOOST_LOCKFREE
-# ifndef UV_LOCKFREE_QUEUE_SIZE
-#  define UV_LOCKFREE_QUEUE_SIZE 128
-# endif
+#ifndef UV_CACHE_LINE_SIZE
+# define UV_CACHE_LINE_SIZE 64
 #endif
 
 #ifndef UV_ASYNC_LAUNCH
@@ -0,0 +1,307 @@
+#ifndef UV_REGISTRY_DETAIL_HPP
+#define UV_REGISTRY_DETAIL_HPP
+
+#include "../defines.hpp"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+//Number of independently locked lists in a loop's handle registry
+#ifndef UV_REGISTRY_SHARDS
+#define UV_REGISTRY_SHARDS 16
+#endif
+
+namespace uv {
+    namespace detail {
+        class Registry;
+
+        /*
+         * Intrusive link embedded in every handle and request, so registering one never allocates and removing
+         * one is just unlinking it from its list.
+         *
+         * The registry either owns the object (strong) or just knows about it (weak). Weak entries remove themselves
+         * when they're destroyed.
+         * */
+        struct RegistryHook {
+            RegistryHook *prev = nullptr, *next = nullptr;
+
+            /*
+             * The registry it's currently in, and the one it was first registered with. registry is only changed with
+             * the shard lock held, but the object can be destroyed on any thread and checks it without the lock.
+             * */
+            std::atomic<Registry *> registry{ nullptr };
+            Registry                *home = nullptr;
+            size_t                  shard = 0;
+
+            //Whether the registry keeps the object alive, remembered across removal so it can be registered again
+            bool owned = false;
+
+            //The handle's closing and ready flags. Requests don't have them.
+            std::atomic_bool *closing = nullptr, *ready = nullptr;
+
+            //Set by mark_closing for handles that are being closed in bulk, until remove_handles takes them out
+            bool bulk_closed = false;
+
+            std::shared_ptr<void> strong;
+            std::weak_ptr<void>   weak;
+
+            RegistryHook() = default;
+
+            RegistryHook( const RegistryHook & ) = delete;
+
+            inline bool linked() const noexcept {
+                return this->registry.load( std::memory_order_acquire ) != nullptr;
+            }
+
+            //Takes it out of whatever registry it's in, if any
+            inline void unlink() noexcept;
+
+            inline ~RegistryHook();
+        };
+
+        /*
+         * Set of everything created on a loop.
+         *
+         * Instead of one big lock around a hash set, entries go into one of several circular lists depending on
+         * which thread created them, each with its own lock. Creating handles from a bunch of threads at once
+         * mostly hits different locks, and the loop thread always hits the same one.
+         * */
+        class Registry {
+            private:
+                struct Shard {
+                    std::mutex   m;
+                    RegistryHook head;
+
+                    //Only changed with the lock held, but can be read without it
+                    std::atomic_size_t count{ 0 }, removed{ 0 };
+
+                    inline Shard() noexcept {
+                        head.prev = head.next = &head;
+                    }
+
+                    //Pads each shard out to its own cache line, so locks on neighbouring shards don't fight
+                    char pad[UV_CACHE_LINE_SIZE];
+                };
+
+                Shard shards[UV_REGISTRY_SHARDS];
+
+                static inline size_t this_shard() noexcept {
+                    return std::hash<std::thread::id>()( std::this_thread::get_id()) % UV_REGISTRY_SHARDS;
+                }
+
+            public:
+                Registry() = default;
+
+                Registry( const Registry & ) = delete;
+
+                /*
+                 * If weak is true, the registry only keeps a weak reference to p, otherwise it keeps p alive until
+                 * it's removed.
+                 * */
+                template <typename T>
+                void insert( RegistryHook *h, const std::shared_ptr<T> &p, bool weak ) {
+                    assert( !h->linked());
+
+                    if( weak ) {
+                        h->weak = p;
+
+                    } else {
+                        h->strong = p;
+                    }
+
+                    h->home  = this;
+                    h->owned = !weak;
+
+                    h->shard = this_shard();
+
+                    Shard &s = this->shards[h->shard];
+
+                    std::lock_guard<std::mutex> lock( s.m );
+
+                    h->registry.store( this, std::memory_order_release );
+
+                    h->prev = s.head.prev;
+                    h->next = &s.head;
+
+                    s.head.prev->next = h;
+                    s.head.prev       = h;
+
+                    s.count.store( s.count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                }
+
+                //Puts a removed entry back the same way it was first registered, such as when a request is reused
+                template <typename T>
+                static void reinsert( RegistryHook *h, const std::shared_ptr<T> &p ) {
+                    if( !h->linked() && h->home != nullptr ) {
+                        h->home->insert( h, p, !h->owned );
+                    }
+                }
+
+                //Unlinks h and drops the registry's reference to it, if it had one
+                void remove( RegistryHook *h ) noexcept {
+                    std::shared_ptr<void> strong;
+
+                    {
+                        Shard &s = this->shards[h->shard];
+
+                        std::lock_guard<std::mutex> lock( s.m );
+
+                        if( h->registry.load( std::memory_order_relaxed ) != this ) {
+                            return;
+                        }
+
+                        h->prev->next = h->next;
+                        h->next->prev = h->prev;
+
+                        h->prev = h->next = nullptr;
+
+                        h->registry.store( nullptr, std::memory_order_release );
+
+                        strong = std::move( h->strong );
+
+                        h->weak.reset();
+
+                        s.count.store( s.count.load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+                        s.removed.store( s.removed.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                    }
+
+                    //Released outside of the lock, since it could be the last reference
+                }
+
+                /*
+                 * Flags every initialized handle that isn't already closing as closing, so nothing else tries to
+                 * close them while they're being closed in bulk. Those are exactly the ones a uv_walk right after
+                 * this on the loop thread will close. Handles still waiting on their initialization are left alone.
+                 * */
+                void mark_closing() noexcept {
+                    for( Shard &s : this->shards ) {
+                        std::lock_guard<std::mutex> lock( s.m );
+
+                        for( RegistryHook *h = s.head.next; h != &s.head; h = h->next ) {
+                            if( h->closing != nullptr && h->ready->load() && !h->closing->exchange( true )) {
+                                h->bulk_closed = true;
+                            }
+                        }
+                    }
+                }
+
+                //Removes every handle flagged by mark_closing. Returns how many were removed.
+                size_t remove_handles() {
+                    std::vector<std::shared_ptr<void>> released;
+
+                    for( Shard &s : this->shards ) {
+                        std::lock_guard<std::mutex> lock( s.m );
+
+                        RegistryHook *h = s.head.next;
+
+                        while( h != &s.head ) {
+                            RegistryHook *next = h->next;
+
+                            if( h->bulk_closed ) {
+                                h->bulk_closed = false;
+
+                                h->prev->next = h->next;
+                                h->next->prev = h->prev;
+
+                                h->prev = h->next = nullptr;
+
+                                h->registry.store( nullptr, std::memory_order_release );
+
+                                h->weak.reset();
+
+                                if( h->strong ) {
+                                    released.push_back( std::move( h->strong ));
+                                }
+
+                                s.count.store( s.count.load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+                                s.removed.store( s.removed.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                            }
+
+                            h = next;
+                        }
+                    }
+
+                    //Everything is let go of here, after all the locks are released
+                    return released.size();
+                }
+
+                /*
+                 * In a forked child, only the forking thread exists, so a shard lock held by any other thread at the
+                 * time would never be released. Every lock is replaced with a fresh one. The lists themselves are
+                 * only changed with a lock held, so they're still intact.
+                 * */
+                void after_fork() noexcept {
+                    for( Shard &s : this->shards ) {
+                        new( &s.m ) std::mutex();
+                    }
+                }
+
+                //Approximate while entries are being added or removed on other threads
+                size_t size() const noexcept {
+                    size_t total = 0;
+
+                    for( const Shard &s : this->shards ) {
+                        total += s.count.load( std::memory_order_relaxed );
+                    }
+
+                    return total;
+                }
+
+                //Total number of entries ever removed
+                size_t removed() const noexcept {
+                    size_t total = 0;
+
+                    for( const Shard &s : this->shards ) {
+                        total += s.removed.load( std::memory_order_relaxed );
+                    }
+
+                    return total;
+                }
+
+                ~Registry() {
+                    for( Shard &s : this->shards ) {
+                        std::lock_guard<std::mutex> lock( s.m );
+
+                        while( s.head.next != &s.head ) {
+                            RegistryHook *h = s.head.next;
+
+                            h->prev->next = h->next;
+                            h->next->prev = h->prev;
+
+                            h->prev = h->next = nullptr;
+
+                            h->registry.store( nullptr, std::memory_order_release );
+
+                            h->weak.reset();
+
+                            //Can't let go of it while holding the lock, in case it's the last reference
+                            std::shared_ptr<void> strong = std::move( h->strong );
+
+                            s.m.unlock();
+
+                            strong.reset();
+
+                            s.m.lock();
+                        }
+                    }
+                }
+        };
+
+        inline void RegistryHook::unlink() noexcept {
+            Registry *r = this->registry.load( std::memory_order_acquire );
+
+            if( r != nullptr ) {
+                r->remove( this );
+            }
+        }
+
+        inline RegistryHook::~RegistryHook() {
+            this->unlink();
+        }
+    }
+}
+
+#endif //UV_REGISTRY_DETAIL_HPP
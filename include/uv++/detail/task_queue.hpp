@@ -0,0 +1,248 @@
+#ifndef UV_TASK_QUEUE_DETAIL_HPP
+#define UV_TASK_QUEUE_DETAIL_HPP
+
+#include "async.hpp"
+
+#include <atomic>
+
+namespace uv {
+    namespace detail {
+        /*
+         * Intrusive node for anything queued onto the loop thread.
+         *
+         * Whatever is being scheduled just inherits from this, so pushing a task never allocates anything extra
+         * for the queue itself. run is responsible for cleaning up the node if it owns itself.
+         * */
+        struct TaskNode {
+            TaskNode *next = nullptr;
+
+            void ( *run )( TaskNode * ) noexcept = nullptr;
+        };
+
+        /*
+         * Unbounded multi-producer/single-consumer queue.
+         *
+         * Producers push onto an atomic stack with a single compare and exchange, so they never take a lock and
+         * never wait on each other for more than a retry. The consumer takes the entire stack with one atomic
+         * exchange and reverses it to get the tasks back in the order they were pushed.
+         *
+         * Only the loop thread should ever call take_all.
+         * */
+        class TaskQueue {
+            private:
+                std::atomic<TaskNode *> head;
+
+            public:
+                inline TaskQueue() noexcept
+                    : head( nullptr ) {
+                }
+
+                TaskQueue( const TaskQueue & ) = delete;
+
+                /*
+                 * Pushes an already linked chain of nodes in one go. The chain is expected to be linked newest first,
+                 * so first is the last task to be run and last->next gets overwritten.
+                 *
+                 * Returns true if the queue was empty beforehand.
+                 * */
+                inline bool push( TaskNode *first, TaskNode *last ) noexcept {
+                    assert( first != nullptr && last != nullptr );
+
+                    TaskNode *h = this->head.load( std::memory_order_relaxed );
+
+                    do {
+                        last->next = h;
+
+                        /*
+                         * seq_cst so the push can't be reordered with the producer checking whether the loop is
+                         * currently draining the queue. See Loop::ring
+                         * */
+                    } while( !this->head.compare_exchange_weak( h, first, std::memory_order_seq_cst,
+                                                                std::memory_order_relaxed ));
+
+                    return h == nullptr;
+                }
+
+                inline bool push( TaskNode *n ) noexcept {
+                    return this->push( n, n );
+                }
+
+                /*
+                 * Returns the whole queue in FIFO order, or nullptr if it was empty.
+                 *
+                 * If tail is given, it's set to the last node in the returned list.
+                 * */
+                inline TaskNode *take_all( TaskNode **tail = nullptr ) noexcept {
+                    TaskNode *n = this->head.exchange( nullptr, std::memory_order_acquire );
+
+                    if( tail != nullptr ) {
+                        *tail = n;
+                    }
+
+                    TaskNode *reversed = nullptr;
+
+                    while( n != nullptr ) {
+                        TaskNode *next = n->next;
+
+                        n->next  = reversed;
+                        reversed = n;
+                        n        = next;
+                    }
+
+                    return reversed;
+                }
+
+                inline bool empty() const noexcept {
+                    return this->head.load( std::memory_order_seq_cst ) == nullptr;
+                }
+        };
+
+        /*
+         * One priority lane of the loop's scheduler. Producers push onto the queue, while the backlog holds whatever
+         * the loop thread has already taken off the queue but hasn't gotten around to running yet.
+         *
+         * Everything except queue is loop thread only.
+         * */
+        struct TaskLane {
+            TaskQueue queue;
+
+            TaskNode *backlog_first = nullptr, *backlog_last = nullptr;
+
+            //Moves everything from the queue onto the end of the backlog, keeping FIFO order
+            inline void collect() noexcept {
+                TaskNode *tail, *taken = this->queue.take_all( &tail );
+
+                if( taken != nullptr ) {
+                    if( this->backlog_last == nullptr ) {
+                        this->backlog_first = taken;
+
+                    } else {
+                        this->backlog_last->next = taken;
+                    }
+
+                    this->backlog_last = tail;
+                }
+            }
+
+            inline TaskNode *pop() noexcept {
+                TaskNode *task = this->backlog_first;
+
+                if( task != nullptr ) {
+                    this->backlog_first = task->next;
+
+                    if( this->backlog_first == nullptr ) {
+                        this->backlog_last = nullptr;
+                    }
+                }
+
+                return task;
+            }
+
+            //Takes n out of the lane if it's queued, for nodes that are about to be freed. Returns true if it was.
+            bool remove( TaskNode *n ) noexcept {
+                this->collect();
+
+                TaskNode *prev = nullptr;
+
+                for( TaskNode *task = this->backlog_first; task != nullptr; prev = task, task = task->next ) {
+                    if( task == n ) {
+                        if( prev == nullptr ) {
+                            this->backlog_first = task->next;
+
+                        } else {
+                            prev->next = task->next;
+                        }
+
+                        if( this->backlog_last == task ) {
+                            this->backlog_last = prev;
+                        }
+
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            inline bool has_backlog() const noexcept {
+                return this->backlog_first != nullptr;
+            }
+
+            inline bool empty() const noexcept {
+                return !this->has_backlog() && this->queue.empty();
+            }
+        };
+
+        /*
+         * AsyncContinuation with the queue node built in, so a scheduled task is a single allocation instead of
+         * a continuation plus a separate queue entry.
+         * */
+        template <typename Functor, typename Self>
+        struct ScheduledContinuation : public TaskNode, public AsyncContinuation<Functor, Self> {
+            inline ScheduledContinuation( Functor f ) noexcept
+                : AsyncContinuation<Functor, Self>( f ) {
+                this->run = &ScheduledContinuation::run_once;
+            }
+
+            static void run_once( TaskNode *n ) noexcept {
+                ScheduledContinuation *c = static_cast<ScheduledContinuation *>(n);
+
+                c->dispatch();
+
+                delete c;
+            }
+        };
+
+        /*
+         * Fire-and-forget task for Loop::post. The functor and its arguments are stored directly in the node,
+         * so posting costs exactly one allocation and no promise or future at all.
+         *
+         * There is nowhere to send an exception thrown from here, so don't.
+         * */
+        template <typename Functor, typename... Args>
+        struct PostedTask : public TaskNode {
+            Functor             f;
+            std::tuple<Args...> args;
+
+            template <typename... Ts>
+            inline PostedTask( Functor _f, Ts &&... _args )
+                : f( std::move( _f )), args( std::forward<Ts>( _args )... ) {
+                this->run = &PostedTask::run_once;
+            }
+
+            static void run_once( TaskNode *n ) noexcept {
+                PostedTask *t = static_cast<PostedTask *>(n);
+
+                invoke( t->f, t->args );
+
+                delete t;
+            }
+        };
+
+        //Sentinel queued at the end of a batch, so it only runs once everything before it has
+        struct BatchDone : public TaskNode {
+            std::promise<void> done;
+
+            inline BatchDone() {
+                this->run = &BatchDone::run_once;
+            }
+
+            static void run_once( TaskNode *n ) noexcept {
+                BatchDone *b = static_cast<BatchDone *>(n);
+
+                b->done.set_value();
+
+                delete b;
+            }
+        };
+
+        template <typename Functor, typename... Args>
+        inline TaskNode *make_posted_task( Functor &&f, Args &&... args ) {
+            typedef PostedTask<typename std::decay<Functor>::type, typename std::decay<Args>::type...> Task;
+
+            return new Task( std::forward<Functor>( f ), std::forward<Args>( args )... );
+        }
+    }
+}
+
+#endif //UV_TASK_QUEUE_DETAIL_HPP
@@ -0,0 +1,166 @@
+#ifndef UV_WORK_STEALING_DETAIL_HPP
+#define UV_WORK_STEALING_DETAIL_HPP
+
+#include "task_queue.hpp"
+
+#include <vector>
+
+namespace uv {
+    namespace detail {
+        /*
+         * Chase-Lev work-stealing deque of tasks.
+         *
+         * The owning thread pushes and pops at the bottom without any contention, while any other thread can steal
+         * from the top. Every steal claims its task with a compare and exchange on top, since thieves race each
+         * other, but the owner only needs one when it pops the very last task and might be racing a thief for it.
+         *
+         * The memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê et al.
+         *
+         * When the buffer fills up it doubles in size. Old buffers can still be read by a thief that is in the middle
+         * of a steal, so they're only freed along with the deque itself.
+         * */
+        class WorkStealingDeque {
+            private:
+                struct Buffer {
+                    const int64_t                          capacity;
+                    std::unique_ptr<std::atomic<TaskNode *>[]> slots;
+
+                    explicit Buffer( int64_t c )
+                        : capacity( c ), slots( new std::atomic<TaskNode *>[c] ) {
+                    }
+
+                    inline TaskNode *get( int64_t i ) const noexcept {
+                        return this->slots[i & ( this->capacity - 1 )].load( std::memory_order_relaxed );
+                    }
+
+                    inline void put( int64_t i, TaskNode *t ) noexcept {
+                        this->slots[i & ( this->capacity - 1 )].store( t, std::memory_order_relaxed );
+                    }
+                };
+
+                std::atomic<int64_t>  top, bottom;
+                std::atomic<Buffer *> buffer;
+
+                //Owner only
+                std::vector<std::unique_ptr<Buffer>> buffers;
+
+                Buffer *grow( Buffer *old, int64_t b, int64_t t ) {
+                    this->buffers.emplace_back( new Buffer( old->capacity * 2 ));
+
+                    Buffer *bigger = this->buffers.back().get();
+
+                    for( int64_t i = t; i < b; ++i ) {
+                        bigger->put( i, old->get( i ));
+                    }
+
+                    this->buffer.store( bigger, std::memory_order_release );
+
+                    return bigger;
+                }
+
+            public:
+                //Capacity has to be a power of two
+                explicit WorkStealingDeque( int64_t capacity = 64 )
+                    : top( 0 ), bottom( 0 ) {
+                    assert( capacity > 0 && ( capacity & ( capacity - 1 )) == 0 );
+
+                    this->buffers.emplace_back( new Buffer( capacity ));
+
+                    this->buffer.store( this->buffers.back().get(), std::memory_order_relaxed );
+                }
+
+                WorkStealingDeque( const WorkStealingDeque & ) = delete;
+
+                //Owner only
+                void push( TaskNode *task ) {
+                    int64_t b = this->bottom.load( std::memory_order_relaxed );
+                    int64_t t = this->top.load( std::memory_order_acquire );
+
+                    Buffer *a = this->buffer.load( std::memory_order_relaxed );
+
+                    if( b - t > a->capacity - 1 ) {
+                        a = this->grow( a, b, t );
+                    }
+
+                    a->put( b, task );
+
+                    std::atomic_thread_fence( std::memory_order_release );
+
+                    this->bottom.store( b + 1, std::memory_order_relaxed );
+                }
+
+                //Owner only, takes the most recently pushed task
+                TaskNode *pop() noexcept {
+                    int64_t b = this->bottom.load( std::memory_order_relaxed ) - 1;
+
+                    Buffer *a = this->buffer.load( std::memory_order_relaxed );
+
+                    this->bottom.store( b, std::memory_order_relaxed );
+
+                    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                    int64_t t = this->top.load( std::memory_order_relaxed );
+
+                    TaskNode *task = nullptr;
+
+                    if( t <= b ) {
+                        task = a->get( b );
+
+                        if( t == b ) {
+                            //Last one left, so race any thieves for it
+                            if( !this->top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst,
+                                                                    std::memory_order_relaxed )) {
+                                task = nullptr;
+                            }
+
+                            this->bottom.store( b + 1, std::memory_order_relaxed );
+                        }
+
+                    } else {
+                        this->bottom.store( b + 1, std::memory_order_relaxed );
+                    }
+
+                    return task;
+                }
+
+                /*
+                 * Any thread, takes the oldest task by bumping top with a compare and exchange. Returns nullptr if empty
+                 * or if another thief or the owner got to the task first.
+                 * */
+                TaskNode *steal() noexcept {
+                    int64_t t = this->top.load( std::memory_order_acquire );
+
+                    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                    int64_t b = this->bottom.load( std::memory_order_acquire );
+
+                    if( t < b ) {
+                        Buffer *a = this->buffer.load( std::memory_order_acquire );
+
+                        TaskNode *task = a->get( t );
+
+                        if( this->top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst,
+                                                               std::memory_order_relaxed )) {
+                            return task;
+                        }
+                    }
+
+                    return nullptr;
+                }
+
+                //Only an estimate when other threads are stealing
+                inline size_t size() const noexcept {
+                    int64_t b = this->bottom.load( std::memory_order_relaxed );
+                    int64_t t = this->top.load( std::memory_order_relaxed );
+
+                    return b > t ? (size_t)( b - t ) : 0;
+                }
+
+                inline bool empty() const noexcept {
+                    return this->size() == 0;
+                }
+        };
+    }
+}
+
+#endif //UV_WORK_STEALING_DETAIL_HPP
@@ -27,6 +27,19 @@ namespace uv {
 
     class Loop;
 
+    class TaskBatch;
+
+    class LoopGroup;
+
+    class Strand;
+
+    class Watchdog;
+
+    class Prefork;
+
+    template <typename>
+    class Channel;
+
     class Timer;
 
     class Async;
@@ -68,6 +81,15 @@ namespace uv {
 
     template <typename... Args>
     inline UV_DECLTYPE_AUTO schedule( std::shared_ptr<Loop>, Args... );
+
+    template <typename... Args>
+    inline void post( std::shared_ptr<Loop>, Args &&... );
+
+    template <typename... Args>
+    inline void dispatch( std::shared_ptr<Loop>, Args &&... );
+
+    template <typename... Args>
+    inline void defer( std::shared_ptr<Loop>, Args &&... );
 }
 
 #endif //UV_FWD_HPP
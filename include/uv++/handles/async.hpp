@@ -69,12 +69,8 @@ namespace uv {
 
             std::atomic_bool is_sending;
 
-        public:
-            inline void start( Functor f ) {
-                this->internal_data->continuation = std::make_shared<Continuation>( f );
-
-                this->is_sending = false;
-
+            //Done here rather than in start, so the handle is usable as soon as it's marked ready
+            inline void _init() noexcept {
                 uv_async_init( this->loop_handle(), this->handle(), []( uv_async_t *h ) {
                     if( h->data != nullptr ) {
                         std::weak_ptr<HandleData> *d = static_cast<std::weak_ptr<HandleData> *>(h->data);
@@ -100,6 +96,20 @@ namespace uv {
                 } );
             }
 
+        public:
+            //Sets up everything that doesn't need the loop, so send works even before start has run on the loop thread
+            inline void pre_start( Functor f ) {
+                this->internal_data->continuation = std::make_shared<Continuation>( f );
+
+                this->is_sending = false;
+            }
+
+            inline void start( Functor f ) {
+                if( !this->internal_data->continuation ) {
+                    this->pre_start( f );
+                }
+            }
+
             /*
              * The enable_if is to generate slightly more appealing error messages when there are
              * incorrect number of arguments given. That way it fails here instead of deep into the details.
@@ -134,7 +144,17 @@ namespace uv {
                      * cause it to run again. So just keep track of it with our own flag so it doesn't confuse it.
                      * */
                     if( !expect_sending ) {
-                        uv_async_send( this->handle());
+                        //A handle created from another thread might not have been initialized on the loop yet
+                        if( this->is_ready()) {
+                            uv_async_send( this->handle());
+
+                        } else {
+                            auto self = this->shared_from_this();
+
+                            this->when_ready( [self] {
+                                uv_async_send( self->handle());
+                            } );
+                        }
                     }
 
                     return ret;
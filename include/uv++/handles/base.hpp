@@ -10,6 +10,7 @@
 #include "../exception.hpp"
 
 #include "../detail/handle.hpp"
+#include "../detail/registry.hpp"
 
 #include <future>
 
@@ -73,10 +74,23 @@ namespace uv {
             typedef D                                                                 derived_type;
             typedef typename detail::UserDataAccess<HandleDataT<H, D>, H>::HandleData HandleData;
 
+            friend class Loop;
+
         protected:
             std::shared_ptr<HandleData> internal_data;
             std::shared_ptr<handle_t>   _handle;
-            std::atomic_bool            closing;
+            std::atomic_bool            closing{ false };
+
+            //Set once the handle has been initialized on the loop thread, right before it's started
+            std::atomic_bool ready{ false };
+
+            //Link into the owning loop's registry
+            detail::RegistryHook registry_hook;
+
+            //Drops the loop's reference to this handle, if it had one
+            inline void unregister() noexcept {
+                this->registry_hook.unlink();
+            }
 
             //Implemented in derived classes
             virtual void _init() = 0;
@@ -84,16 +98,60 @@ namespace uv {
             virtual void _stop() = 0;
 
         public:
+            //Set up before the handle is ever registered, since the registry reads them under its own locks
+            inline HandleBase() noexcept {
+                this->registry_hook.closing = &this->closing;
+                this->registry_hook.ready   = &this->ready;
+            }
+
             inline void init( std::shared_ptr<Loop> l ) {
+                this->attach( l );
+
+                this->_init();
+            }
+
+            /*
+             * First half of init, which doesn't touch the event loop and so can be done from any thread. The handle
+             * can be handed out after this, but nothing can be done with it on the loop until init_on_loop has run.
+             * */
+            inline void attach( std::shared_ptr<Loop> l ) {
                 this->_loop_init( l );
 
                 this->internal_data = std::make_shared<HandleData>( std::static_pointer_cast<derived_type>( this->shared_from_this()), this->_handle );
 
                 this->handle()->data = new std::weak_ptr<HandleData>( this->internal_data );
+            }
+
+            /*
+             * Called with the start arguments right after attach, for handles that need some state ready before
+             * start gets to run on the loop. Hidden by handles that need it.
+             * */
+            template <typename... Args>
+            inline void pre_start( Args &&... ) noexcept {
+            }
+
+            //Second half of init, on the loop thread
+            inline void init_on_loop() {
+                assert( this->on_loop_thread());
 
                 this->_init();
             }
 
+            inline void mark_ready() noexcept {
+                this->ready = true;
+            }
+
+            inline bool is_ready() const noexcept {
+                return this->ready;
+            }
+
+            /*
+             * Runs f right away if the handle is ready, otherwise queues it on the loop behind the handle's own
+             * initialization, so operations on a handle still being set up happen in the order they were made.
+             * */
+            template <typename Functor>
+            void when_ready( Functor &&f );
+
             void stop() {
                 //TODO: Remove thread restriction
                 assert( this->on_loop_thread());
@@ -122,6 +180,26 @@ namespace uv {
                     HANDLE_TYPE_MAX
             };
 
+        protected:
+            /*
+             * For handles created from another thread that the loop hasn't initialized yet. Queues up f( self )
+             * behind the initialization and returns true, or returns false if the handle is ready to go.
+             * */
+            template <typename Functor>
+            inline bool queue_until_ready( Functor f ) {
+                if( this->is_ready()) {
+                    return false;
+                }
+
+                std::shared_ptr<D> self = this->shared_from_this();
+
+                this->when_ready( [self, f] {
+                    f( self );
+                } );
+
+                return true;
+            }
+
         public:
             Handle() {
                 this->_handle = std::make_shared<handle_t>();
@@ -147,6 +225,45 @@ namespace uv {
                 return uv_handle_size( this->handle()->type );
             }
 
+            /*
+             * Operations from here on are loop thread only. On a handle that isn't ready yet, they're queued up
+             * behind its initialization, in the order they were made.
+             * */
+            void stop() {
+                assert( this->on_loop_thread());
+
+                if( !this->queue_until_ready( []( std::shared_ptr<D> self ) {
+                    self->stop();
+                } )) {
+                    this->_stop();
+                }
+            }
+
+            //Unreferenced handles don't keep the loop alive on their own
+            inline void ref() {
+                assert( this->on_loop_thread());
+
+                if( !this->queue_until_ready( []( std::shared_ptr<D> self ) {
+                    self->ref();
+                } )) {
+                    uv_ref((uv_handle_t *)( this->handle()));
+                }
+            }
+
+            inline void unref() {
+                assert( this->on_loop_thread());
+
+                if( !this->queue_until_ready( []( std::shared_ptr<D> self ) {
+                    self->unref();
+                } )) {
+                    uv_unref((uv_handle_t *)( this->handle()));
+                }
+            }
+
+            inline bool has_ref() const noexcept {
+                return uv_has_ref((const uv_handle_t *)( this->handle())) != 0;
+            }
+
             template <typename Functor>
             std::shared_future<void> close( Functor );
 
@@ -177,7 +294,8 @@ namespace uv {
             }
 
             ~Handle() {
-                if( !this->is_closing()) {
+                //A handle that was never initialized has nothing to stop
+                if( !this->is_closing() && this->is_ready()) {
                     this->stop();
                 }
             }
@@ -26,6 +26,12 @@ namespace uv {
         public:
             template <typename Functor>
             inline void start( Functor f ) {
+                if( this->queue_until_ready( [f]( std::shared_ptr<Idle> self ) {
+                    self->start( f );
+                } )) {
+                    return;
+                }
+
                 typedef detail::Continuation<Functor, Idle> Cont;
 
                 this->internal_data->continuation = std::make_shared<Cont>( f );
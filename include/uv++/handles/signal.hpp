@@ -27,6 +27,12 @@ namespace uv {
         public:
             template <typename Functor>
             inline void start( int signum, Functor f ) {
+                if( this->queue_until_ready( [signum, f]( std::shared_ptr<Signal> self ) {
+                    self->start( signum, f );
+                } )) {
+                    return;
+                }
+
                 typedef detail::Continuation<Functor, Signal> Cont;
 
                 this->internal_data->continuation = std::make_shared<Cont>( f );
@@ -12,17 +12,35 @@ namespace uv {
         public:
             typedef typename Handle<uv_timer_t, Timer>::handle_t handle_t;
 
+            friend class Loop;
+
         protected:
             typedef typename Handle<uv_timer_t, Timer>::HandleData HandleData;
 
+            /*
+             * For loops on virtual time, where the loop keeps the timer in its own heap instead of libuv's. Bumping
+             * the generation invalidates whatever entry the heap still has for it.
+             * */
+            uv_timer_cb virtual_cb         = nullptr;
+            uint64_t    virtual_repeat     = 0;
+            uint64_t    virtual_generation = 0;
+            bool        virtual_active     = false;
+
             inline void _init() noexcept {
                 uv_timer_init( this->loop_handle(), this->handle());
             }
 
             inline void _stop() noexcept {
+                ++this->virtual_generation;
+
+                this->virtual_active = false;
+
                 uv_timer_stop( this->handle());
             }
 
+            //Starts it with libuv, or on the loop's virtual clock. Defined in loop.hpp.
+            void start_timer( uv_timer_cb cb, uint64_t timeout, uint64_t repeat );
+
         public:
             template <typename Functor,
                       typename _Rep, typename _Period,
@@ -33,13 +51,19 @@ namespace uv {
                                std::chrono::duration<_Rep2, _Period2>(
                                    std::chrono::duration_values<_Rep2>::zero())) {
 
+                if( this->queue_until_ready( [f, timeout, repeat]( std::shared_ptr<Timer> self ) {
+                    self->start( f, timeout, repeat );
+                } )) {
+                    return;
+                }
+
                 typedef std::chrono::duration<uint64_t, std::milli> millis;
 
                 typedef detail::Continuation<Functor, Timer> Cont;
 
                 this->internal_data->continuation = std::make_shared<Cont>( f );
 
-                uv_timer_start( this->handle(), []( uv_timer_t *h ) {
+                this->start_timer( []( uv_timer_t *h ) {
                     std::weak_ptr<HandleData> *d = static_cast<std::weak_ptr<HandleData> *>(h->data);
 
                     if( d != nullptr ) {
@@ -55,6 +79,10 @@ namespace uv {
                     //libuv expects milliseconds, so convert any duration given to milliseconds
                 }, std::chrono::duration_cast<millis>( timeout ).count(), std::chrono::duration_cast<millis>( repeat ).count());
             }
+
+            inline bool is_active() const noexcept {
+                return this->virtual_active ? !this->closing : Handle<uv_timer_t, Timer>::is_active();
+            }
     };
 }
 
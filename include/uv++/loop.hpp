@@ -9,24 +9,43 @@
 #include "request.hpp"
 #include "fs.hpp"
 
+#include "detail/task_queue.hpp"
+
 #include <thread>
-#include <unordered_set>
-#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
 #include <iomanip>
 
-#ifndef UV_DEFAULT_LOOP_SLEEP
-#define UV_DEFAULT_LOOP_SLEEP 1ms
+//Maximum number of scheduled tasks run per loop iteration, 0 for no limit
+#ifndef UV_DRAIN_BUDGET_TASKS
+#define UV_DRAIN_BUDGET_TASKS 0
 #endif
 
-#ifdef UV_USE_BOOST_LOCKFREE
+//Maximum time spent running scheduled tasks per loop iteration, 0 for no limit
+#ifndef UV_DRAIN_BUDGET_TIME
+#define UV_DRAIN_BUDGET_TIME 0ns
+#endif
 
-#include <boost/lockfree/queue.hpp>
+//How often Loop::enable_metrics samples idle time and measures lag
+#ifndef UV_METRICS_INTERVAL
+#define UV_METRICS_INTERVAL 100ms
+#endif
 
-#else
+//Longest RUN_SPIN will busy-poll before blocking
+#ifndef UV_SPIN_BUDGET
+#define UV_SPIN_BUDGET 50us
+#endif
 
-#include <mutex>
-#include <deque>
+//Longest the loop spends on idle tasks before checking for I/O again
+#ifndef UV_IDLE_SLICE
+#define UV_IDLE_SLICE 1ms
+#endif
 
+//Time all sliced tasks get per loop iteration, altogether
+#ifndef UV_TIME_SLICE
+#define UV_TIME_SLICE 2ms
 #endif
 
 namespace uv {
@@ -42,10 +61,26 @@ namespace uv {
 
             friend class fs::Filesystem;
 
+            friend class TaskBatch;
+
+            friend class LoopGroup;
+
+            friend class Timer;
+
+            template <typename>
+            friend
+            class Channel;
+
             enum run_mode : std::underlying_type<uv_run_mode>::type {
                 RUN_DEFAULT = UV_RUN_DEFAULT,
                 RUN_ONCE    = UV_RUN_ONCE,
-                RUN_NOWAIT  = UV_RUN_NOWAIT
+                RUN_NOWAIT  = UV_RUN_NOWAIT,
+
+                /*
+                 * Only valid for run_forever. Busy-polls with UV_RUN_NOWAIT for up to the spin budget before
+                 * blocking, trading a core for latency.
+                 * */
+                RUN_SPIN    = 0x100
             };
 
             enum class uv_option : std::underlying_type<uv_loop_option>::type {
@@ -56,6 +91,51 @@ namespace uv {
                     WAIT_ON_CLOSE
             };
 
+            /*
+             * Lanes for scheduled tasks. Higher priority lanes get more tasks run per round, but every lane gets at
+             * least one per round, so background work still makes progress under a constant stream of urgent tasks.
+             * */
+            enum class priority : unsigned {
+                    URGENT = 0,
+                    NORMAL,
+                    BACKGROUND,
+                    PRIORITY_MAX
+            };
+
+            /*
+             * Handed to sliced tasks every time they're resumed, so they know when to give the loop back.
+             * */
+            class Slice {
+                private:
+                    uint64_t deadline;
+                    size_t   _resumes;
+
+                    friend class Loop;
+
+                    inline Slice() noexcept
+                        : deadline( 0 ), _resumes( 0 ) {
+                    }
+
+                public:
+                    Slice( const Slice & ) = delete;
+
+                    //True once this slice is used up, at which point the task should save its place and return true
+                    inline bool yield() const noexcept {
+                        return uv_hrtime() >= this->deadline;
+                    }
+
+                    inline std::chrono::nanoseconds remaining() const noexcept {
+                        uint64_t t = uv_hrtime();
+
+                        return std::chrono::nanoseconds( t < this->deadline ? this->deadline - t : 0 );
+                    }
+
+                    //How many slices the task has had before this one
+                    inline size_t resumes() const noexcept {
+                        return this->_resumes;
+                    }
+            };
+
         private:
             bool external;
 
@@ -63,22 +143,177 @@ namespace uv {
 
             std::atomic_bool stopped, has_ran;
 
-            typedef std::unordered_map<void *, std::weak_ptr<void>> weak_handle_map;
-            typedef std::unordered_set<std::shared_ptr<void>>       handle_set;
+            //Every handle and request created on this loop. Strong entries are owned by the loop until closed.
+            detail::Registry registry;
 
-            weak_handle_map                                           weak_handles;
-            handle_set                                                handles;
-            std::mutex                                                handle_mutex;
+            //Only taken for handles initialized from other threads before the loop has ever run
+            std::mutex init_mutex;
 
-            typedef detail::TrivialPair<void *, void ( * )( void * )> scheduled_task;
+            //Handles still waiting on their close callback from close_all, and what to run after. Loop thread only.
+            size_t                             bulk_closing;
+            std::vector<std::function<void()>> bulk_close_waiters;
 
-#ifdef UV_USE_BOOST_LOCKFREE
-            boost::lockfree::queue<scheduled_task> task_queue;
-#else
-            std::deque<scheduled_task> task_queue;
-            std::mutex                 schedule_mutex;
+            /*
+             * Bumped every time close_all starts. Handles created off the loop thread compare it once they're
+             * initialized, and close themselves if a close_all started while they were waiting.
+             * */
+            std::atomic<uint64_t> close_all_count;
+
+            //Set once the loop's own handles have been closed by try_close, after which the doorbell is gone
+            std::atomic_bool internal_closed;
+
+            detail::TaskLane lanes[(unsigned)priority::PRIORITY_MAX];
+
+            struct VirtualTimer {
+                uint64_t             deadline, seq, generation;
+                std::weak_ptr<Timer> timer;
+
+                //For a min-heap, with ties going to whichever was started first, same as libuv
+                inline bool operator<( const VirtualTimer &other ) const noexcept {
+                    return this->deadline > other.deadline ||
+                           ( this->deadline == other.deadline && this->seq > other.seq );
+                }
+            };
+
+            //Virtual clock, in the same milliseconds as uv_now. Loop thread only.
+            bool                      virtual_clock;
+            uint64_t                  virtual_now, virtual_seq;
+            std::vector<VirtualTimer> virtual_timers;
+
+            /*
+             * The doorbell is a bare uv_async_t instead of an Async handle, since all it has to do is wake up the
+             * loop. Ringing it never takes a lock or allocates anything.
+             *
+             * draining is set while the loop thread is running through the task queue, so producers don't bother
+             * waking up a loop that is going to see their task anyway.
+             * */
+            uv_async_t       doorbell;
+            std::atomic_bool draining;
+
+            /*
+             * Background tasks from schedule_idle. They're only run from idle_probe, right before the loop would
+             * otherwise block in poll. idle_keepalive is only active while some are waiting, so poll doesn't block
+             * on them, but the loop doesn't spin with nothing to do either.
+             * */
+            detail::TaskLane      idle_lane;
+            std::atomic_size_t    idle_queued;
+            std::atomic<uint64_t> idle_slice_ns, idle_tasks_run_count;
+            uv_prepare_t          idle_probe;
+            uv_idle_t             idle_keepalive;
+
+            struct SlicedTask {
+                std::function<bool( Slice & )> fn;
+                std::promise<void>             done;
+                Slice                          slice;
+                SlicedTask                     *next;
+            };
+
+            /*
+             * Tasks from spawn_sliced, resumed round robin from slice_check after every poll. Only touched on the
+             * loop thread. slice_keepalive keeps poll from blocking while there are any.
+             * */
+            SlicedTask            *sliced_first, *sliced_last;
+            std::atomic_size_t    sliced_count;
+            std::atomic<uint64_t> time_slice_ns;
+            uv_check_t            slice_check;
+            uv_idle_t             slice_keepalive;
+
+            /*
+             * Tasks deferred from the loop thread itself. Only ever touched on the loop thread, so it's just a
+             * plain FIFO list that gets run after the current batch of scheduled tasks.
+             * */
+            detail::TaskNode *deferred_first, *deferred_last;
+
+            /*
+             * run_forever parks the loop thread here when libuv has nothing left to do, instead of sleeping and
+             * polling. Producers only touch the mutex if they see parked set.
+             * */
+            std::mutex              park_mutex;
+            std::condition_variable park_cv;
+            std::atomic_bool        parked;
+
+            /*
+             * While RUN_SPIN is busy-polling, the loop checks the task queues itself, so producers don't need to
+             * ring the doorbell at all.
+             * */
+            std::atomic_bool      spinning;
+            std::atomic<uint64_t> spin_budget_ns;
+            std::atomic<uint64_t> spin_hit_count, blocking_wakeup_count;
+
+            //Tasks pushed onto the lanes but not run yet, as a rough measure of how far behind the loop is
+            std::atomic_size_t queued_tasks;
+
+            std::atomic_size_t    drain_budget_tasks;
+            std::atomic<uint64_t> drain_budget_ns;
+            std::atomic<uint64_t> drain_budget_hits;
+
+            std::atomic<const void *> current_task;
+
+            //Only written on the loop thread, so they're bumped without a locked increment
+            std::atomic<uint64_t> doorbell_count, drain_count, tasks_run_count;
+
+            //Sampled by the metrics timer
+            std::atomic<uint64_t> iteration_count, idle_ns, busy_ns, lag_ns, max_lag_ns;
+
+            std::shared_ptr<Timer> metrics_timer;
+
+            uint64_t metrics_started, last_sample, metrics_interval_ns;
+
+            //libuv's idle time is cumulative for the life of the loop, so this is where it stood at enable_metrics
+            uint64_t metrics_idle_base;
+
+            //When the metrics timer should fire next, or 0 if metrics are off. Read from any thread to measure lag.
+            std::atomic<uint64_t> next_sample_ns;
+
+            //Admission limits for try_schedule and try_post, 0 for none
+            std::atomic_size_t    max_queue_depth;
+            std::atomic<uint64_t> max_lag_allowed_ns;
+            std::atomic<uint64_t> rejected_depth_count, rejected_lag_count;
+
+#if UV_VERSION_HEX < 0x012D00
+            //No uv_metrics_info before libuv 1.45, so count iterations ourselves
+            std::shared_ptr<Prepare> iteration_counter;
+#endif
+
+            static inline void bump( std::atomic<uint64_t> &counter, uint64_t n = 1 ) noexcept {
+                counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+            }
+
+            //Runs on the loop thread every metrics interval
+            void sample_metrics() noexcept {
+                uint64_t t        = uv_hrtime();
+                uint64_t expected = this->last_sample + this->metrics_interval_ns;
+                uint64_t lag      = t > expected ? t - expected : 0;
+
+                this->last_sample = t;
+
+                //On virtual time the timer fires whenever the clock is advanced, so lag against real time means nothing
+                if( !this->virtual_clock ) {
+                    this->next_sample_ns.store( t + this->metrics_interval_ns, std::memory_order_relaxed );
+
+                    this->lag_ns.store( lag, std::memory_order_relaxed );
+
+                    if( lag > this->max_lag_ns.load( std::memory_order_relaxed )) {
+                        this->max_lag_ns.store( lag, std::memory_order_relaxed );
+                    }
+                }
+
+#if UV_VERSION_HEX >= 0x012700
+                uint64_t idle    = uv_metrics_idle_time( this->handle()) - this->metrics_idle_base;
+                uint64_t elapsed = t - this->metrics_started;
+
+                this->idle_ns.store( idle, std::memory_order_relaxed );
+                this->busy_ns.store( elapsed > idle ? elapsed - idle : 0, std::memory_order_relaxed );
+#endif
+
+#if UV_VERSION_HEX >= 0x012D00
+                uv_metrics_t info;
+
+                if( uv_metrics_info( this->handle(), &info ) == 0 ) {
+                    this->iteration_count.store( info.loop_count, std::memory_order_relaxed );
+                }
 #endif
-            std::shared_ptr<Async> schedule_async;
+            }
 
         protected:
             std::thread::id _loop_thread;
@@ -88,199 +323,1434 @@ namespace uv {
                     uv_loop_init( this->handle());
                 }
 
-                this->schedule_async = this->async( [this] {
-                    assert( this->on_loop_thread());
+                this->draining = false;
 
-#ifdef UV_USE_BOOST_LOCKFREE
-                    this->task_queue.consume_all( [this]( scheduled_task &task ) {
-                        task.second( task.first );
-                    } );
-#else
-                    {
-                        std::lock_guard<std::mutex> lock( this->schedule_mutex );
+                this->doorbell.data = this;
+
+                uv_async_init( this->handle(), &this->doorbell, []( uv_async_t *h ) {
+                    Loop *self = static_cast<Loop *>(h->data);
+
+                    assert( self->on_loop_thread());
+
+                    bump( self->doorbell_count );
+
+                    self->drain_tasks();
+
+                    self->update_time();
+                } );
+
+                this->idle_probe.data     = this;
+                this->idle_keepalive.data = this;
+
+                uv_prepare_init( this->handle(), &this->idle_probe );
+                uv_idle_init( this->handle(), &this->idle_keepalive );
+
+                //Idle tasks are kept alive by idle_keepalive, not the probe
+                uv_unref((uv_handle_t *)&this->idle_probe );
+
+                this->slice_check.data     = this;
+                this->slice_keepalive.data = this;
+
+                uv_check_init( this->handle(), &this->slice_check );
+                uv_idle_init( this->handle(), &this->slice_keepalive );
+
+                this->_fs = fs::Filesystem::make_filesystem( this->shared_from_this());
+            }
+
+            inline detail::TaskLane &lane( priority p ) noexcept {
+                assert( p < priority::PRIORITY_MAX );
+
+                return this->lanes[(unsigned)p];
+            }
+
+            inline bool has_pending_tasks() const noexcept {
+                for( const detail::TaskLane &l : this->lanes ) {
+                    if( !l.empty()) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /*
+             * One exchange per lane takes everything queued up since the last wakeup, which is then run in weighted
+             * rounds until either every lane is empty or the drain budget runs out. Whatever is left over stays in
+             * the lane backlogs for the next iteration, so timers and I/O still get a turn during a big burst of
+             * scheduled tasks.
+             * */
+            inline void drain_tasks() noexcept {
+                //Tasks run from each lane per round, in priority order
+                static constexpr size_t weights[] = { 16, 4, 1 };
+
+                static_assert( sizeof( weights ) / sizeof( weights[0] ) == (size_t)priority::PRIORITY_MAX,
+                               "every priority lane needs a weight" );
+
+                this->draining = true;
+
+                for( detail::TaskLane &l : this->lanes ) {
+                    l.collect();
+                }
+
+                const size_t   max_tasks = this->drain_budget_tasks.load( std::memory_order_relaxed );
+                const uint64_t max_ns    = this->drain_budget_ns.load( std::memory_order_relaxed );
+                const uint64_t start     = max_ns != 0 ? uv_hrtime() : 0;
+
+                size_t ran       = 0;
+                bool   exhausted = false, any = true;
+
+                while( any && !exhausted ) {
+                    any = false;
+
+                    for( size_t i = 0; i < (size_t)priority::PRIORITY_MAX && !exhausted; ++i ) {
+                        for( size_t n = 0; n < weights[i]; ++n ) {
+                            if(( max_tasks != 0 && ran >= max_tasks ) ||
+                               ( max_ns != 0 && ran != 0 && uv_hrtime() - start >= max_ns )) {
+                                exhausted = true;
+
+                                break;
+                            }
+
+                            detail::TaskNode *task = this->lanes[i].pop();
 
-                        for( scheduled_task &task : this->task_queue ) {
-                            task.second( task.first );
+                            if( task == nullptr ) {
+                                break;
+                            }
+
+                            this->run_task( task );
+
+                            any = true;
+                            ++ran;
                         }
+                    }
+                }
 
-                        this->task_queue.clear();
+                this->queued_tasks.fetch_sub( ran, std::memory_order_relaxed );
+
+                bump( this->drain_count );
+                bump( this->tasks_run_count, ran );
+
+                if( exhausted ) {
+                    for( const detail::TaskLane &l : this->lanes ) {
+                        if( l.has_backlog()) {
+                            this->drain_budget_hits.fetch_add( 1, std::memory_order_relaxed );
+
+                            break;
+                        }
                     }
-#endif
-                    this->update_time();
-                }, true ); //Use weak reference since we're storing this one separately
+                }
 
-                this->_fs = fs::Filesystem::make_filesystem( this->shared_from_this());
+                this->run_deferred();
+
+                if( this->idle_queued.load( std::memory_order_relaxed ) != 0 ) {
+                    this->arm_idle();
+                }
+
+                this->draining = false;
+
+                /*
+                 * Anything pushed or deferred while draining didn't ring the doorbell, so ring it here and pick those
+                 * up on the next iteration instead of starving everything else on the loop.
+                 * */
+                if( this->deferred_first != nullptr || this->has_pending_tasks()) {
+                    uv_async_send( &this->doorbell );
+                }
             }
 
-            inline void _stop() {
-                stopped = true;
+            //Runs only what was deferred before this point, anything deferred from inside those waits a turn
+            inline void run_deferred() noexcept {
+                detail::TaskNode *task = this->deferred_first;
 
-                uv_stop( handle());
+                this->deferred_first = this->deferred_last = nullptr;
+
+                while( task != nullptr ) {
+                    detail::TaskNode *next = task->next;
+
+                    this->run_task( task );
+
+                    task = next;
+                }
             }
 
-        public:
-            inline const handle_t *handle() const noexcept {
-                return _handle.get();
+            //Keeps track of which task is running, so a stalled loop can say what it's stuck on
+            inline void run_task( detail::TaskNode *task ) noexcept {
+                this->current_task.store( reinterpret_cast<const void *>(task->run), std::memory_order_relaxed );
+
+                task->run( task );
+
+                this->current_task.store( nullptr, std::memory_order_relaxed );
             }
 
-            inline handle_t *handle() noexcept {
-                return _handle.get();
+            //Starts watching for a chance to run idle tasks, if it isn't already
+            inline void arm_idle() noexcept {
+                if( !uv_is_active((uv_handle_t *)&this->idle_probe )) {
+                    uv_prepare_start( &this->idle_probe, &Loop::on_idle_probe );
+                    uv_idle_start( &this->idle_keepalive, []( uv_idle_t * ) {} );
+                }
             }
 
-        private:
-            explicit inline Loop()
-                : _loop_thread( std::this_thread::get_id())
-#ifdef UV_USE_BOOST_LOCKFREE
-                , task_queue( UV_LOCKFREE_QUEUE_SIZE )
-#endif
-            {}
+            /*
+             * Runs right before poll. Our own idle handle is stopped first, since it would always make the loop
+             * look busy, and then if libuv would still block in poll (or has nothing else left at all) and there
+             * are no scheduled tasks waiting, a slice of idle tasks gets run. The slice never runs past the next
+             * timer.
+             *
+             * Any time spent here shows up as busy time in the metrics, not idle time.
+             * */
+            static void on_idle_probe( uv_prepare_t *h ) {
+                Loop *self = static_cast<Loop *>(h->data);
 
-        public:
-            Loop( const Loop & ) = delete;
+                uv_idle_stop( &self->idle_keepalive );
 
-            //TODO: Figure out move semantics with atomic values
-            //Loop( Loop && ) = delete;
+                self->idle_lane.collect();
 
-            static inline std::shared_ptr<Loop> make_loop( handle_t *l = nullptr ) {
-                auto loop = std::shared_ptr<Loop>( new Loop());
+                if( !self->idle_lane.has_backlog()) {
+                    //Anything pushed after the collect rings the doorbell, which arms this again
+                    uv_prepare_stop( h );
 
-                if( l == nullptr ) {
-                    loop->_handle = std::make_shared<handle_t>();
+                    return;
+                }
+
+                int timeout = uv_backend_timeout( self->handle());
+
+                if(( timeout != 0 || !uv_loop_alive( self->handle())) &&
+                   self->deferred_first == nullptr && !self->has_pending_tasks()) {
+                    self->run_idle_slice( timeout );
+                }
+
+                if( self->idle_lane.has_backlog()) {
+                    //Keeps poll from blocking, so we come right back here after checking for I/O
+                    uv_idle_start( &self->idle_keepalive, []( uv_idle_t * ) {} );
 
                 } else {
+                    uv_prepare_stop( h );
+                }
+            }
 
-                    struct no_deleter {
-                        void operator()( handle_t *p ) const {
-                        };
-                    };
+            //Always runs at least one task
+            inline void run_idle_slice( int timeout_ms ) noexcept {
+                uint64_t budget = this->idle_slice_ns.load( std::memory_order_relaxed );
 
-                    loop->_handle = std::shared_ptr<handle_t>( l, no_deleter());
+                if( timeout_ms > 0 ) {
+                    budget = std::min( budget, (uint64_t)timeout_ms * 1000000 );
+                }
 
-                    loop->external = true;
+                const uint64_t start = uv_hrtime();
+
+                size_t ran = 0;
+
+                do {
+                    detail::TaskNode *task = this->idle_lane.pop();
+
+                    if( task == nullptr ) {
+                        break;
+                    }
+
+                    this->run_task( task );
+
+                    ++ran;
+
+                } while( uv_hrtime() - start < budget );
+
+                this->idle_queued.fetch_sub( ran, std::memory_order_relaxed );
+
+                bump( this->idle_tasks_run_count, ran );
+            }
+
+            inline void add_virtual_timer( const std::shared_ptr<Timer> &t, uint64_t deadline ) {
+                this->virtual_timers.push_back( VirtualTimer{ deadline, this->virtual_seq++, t->virtual_generation, t } );
+
+                std::push_heap( this->virtual_timers.begin(), this->virtual_timers.end());
+            }
+
+            //Fires every virtual timer due by target, skipping entries left over from stopped or closed timers
+            size_t fire_virtual_timers( uint64_t target ) {
+                size_t fired = 0;
+
+                while( !this->virtual_timers.empty() && this->virtual_timers.front().deadline <= target ) {
+                    std::pop_heap( this->virtual_timers.begin(), this->virtual_timers.end());
+
+                    VirtualTimer e = std::move( this->virtual_timers.back());
+
+                    this->virtual_timers.pop_back();
+
+                    std::shared_ptr<Timer> t = e.timer.lock();
+
+                    if( !t || t->virtual_generation != e.generation || t->is_closing()) {
+                        continue;
+                    }
+
+                    this->virtual_now = std::max( this->virtual_now, e.deadline );
+
+                    //Rescheduled before the callback, like libuv does, so the callback can still stop it
+                    if( t->virtual_repeat != 0 ) {
+                        this->add_virtual_timer( t, this->virtual_now + t->virtual_repeat );
+
+                    } else {
+                        t->virtual_active = false;
+                    }
+
+                    t->virtual_cb( t->handle());
+
+                    ++fired;
+
+                    if( !this->draining && ( this->deferred_first != nullptr || this->has_pending_tasks())) {
+                        this->drain_tasks();
+                    }
                 }
 
-                loop->init( loop->shared_from_this());
+                return fired;
+            }
 
-                return loop;
+            //Checks the admission limits, counting the rejection if there is one
+            inline bool admit() noexcept {
+                const size_t max_depth = this->max_queue_depth.load( std::memory_order_relaxed );
+
+                if( max_depth != 0 && this->pending_tasks() >= max_depth ) {
+                    this->rejected_depth_count.fetch_add( 1, std::memory_order_relaxed );
+
+                    return false;
+                }
+
+                const uint64_t max_lag = this->max_lag_allowed_ns.load( std::memory_order_relaxed );
+
+                if( max_lag != 0 && (uint64_t)this->current_lag().count() > max_lag ) {
+                    this->rejected_lag_count.fetch_add( 1, std::memory_order_relaxed );
+
+                    return false;
+                }
+
+                return true;
             }
 
-            inline std::shared_ptr<fs::Filesystem> fs() noexcept {
-                return _fs;
+            inline void enqueue_idle( detail::TaskNode *task ) noexcept {
+                this->idle_queued.fetch_add( 1, std::memory_order_relaxed );
+
+                //Doesn't care about draining or spinning, since only the doorbell callback arms the probe
+                if( this->idle_lane.queue.push( task ) && !this->internal_closed ) {
+                    uv_async_send( &this->doorbell );
+                }
+
+                this->unpark();
             }
 
-            inline int run( run_mode mode = RUN_DEFAULT ) noexcept {
-                this->stopped = false;
+            inline void add_sliced( SlicedTask *t ) noexcept {
+                assert( this->on_loop_thread());
 
-                this->_loop_thread = std::this_thread::get_id();
+                t->next = nullptr;
 
-                this->has_ran = true;
+                if( this->sliced_last == nullptr ) {
+                    this->sliced_first = this->sliced_last = t;
 
-                return uv_run( this->handle(), (uv_run_mode)( mode ));
+                    uv_check_start( &this->slice_check, &Loop::on_slice_check );
+                    uv_idle_start( &this->slice_keepalive, []( uv_idle_t * ) {} );
+
+                } else {
+                    this->sliced_last->next = t;
+                    this->sliced_last       = t;
+                }
+
+                this->sliced_count.fetch_add( 1, std::memory_order_relaxed );
             }
 
-            template <typename _Rep, typename _Period>
-            void run_forever( const std::chrono::duration<_Rep, _Period> &delay, run_mode mode = RUN_DEFAULT ) noexcept {
-                this->stopped = false;
+            /*
+             * Resumes sliced tasks one after another until the time slice for this iteration is used up. Whatever
+             * isn't finished goes to the back of the line, so the next iteration starts with whoever didn't get a
+             * turn this time.
+             * */
+            static void on_slice_check( uv_check_t *h ) {
+                Loop *self = static_cast<Loop *>(h->data);
 
-#ifdef UV_DETRACT_LOOP
-                typedef std::chrono::nanoseconds                       nano;
-                typedef std::chrono::high_resolution_clock::time_point time_point;
+                const uint64_t deadline = uv_hrtime() + self->time_slice_ns.load( std::memory_order_relaxed );
+
+                //Each task gets at most one turn, and anything spawned from inside a task waits until next time
+                size_t turns = self->sliced_count.load( std::memory_order_relaxed );
+
+                for( ; turns > 0 && self->sliced_first != nullptr; --turns ) {
+                    SlicedTask *t = self->sliced_first;
+
+                    self->sliced_first = t->next;
+
+                    if( self->sliced_first == nullptr ) {
+                        self->sliced_last = nullptr;
+                    }
+
+                    t->slice.deadline = deadline;
+
+                    bool               more = false;
+                    std::exception_ptr error;
+
+                    try {
+                        more = t->fn( t->slice );
+
+                    } catch( ... ) {
+                        error = std::current_exception();
+                    }
+
+                    if( more ) {
+                        ++t->slice._resumes;
+
+                        t->next = nullptr;
+
+                        if( self->sliced_last == nullptr ) {
+                            self->sliced_first = self->sliced_last = t;
+
+                        } else {
+                            self->sliced_last->next = t;
+                            self->sliced_last       = t;
+                        }
+
+                    } else {
+                        self->sliced_count.fetch_sub( 1, std::memory_order_relaxed );
+
+                        if( error ) {
+                            t->done.set_exception( error );
+
+                        } else {
+                            t->done.set_value();
+                        }
+
+                        delete t;
+                    }
+
+                    if( uv_hrtime() >= deadline ) {
+                        break;
+                    }
+                }
+
+                if( self->sliced_first == nullptr ) {
+                    uv_check_stop( h );
+                    uv_idle_stop( &self->slice_keepalive );
+                }
+            }
+
+            inline void push_deferred( detail::TaskNode *n ) noexcept {
+                assert( this->on_loop_thread());
+
+                n->next = nullptr;
+
+                if( this->deferred_last == nullptr ) {
+                    this->deferred_first = this->deferred_last = n;
+
+                    //If it's draining right now it'll pick this up at the end anyway
+                    if( !this->draining && !this->internal_closed ) {
+                        uv_async_send( &this->doorbell );
+                    }
+
+                } else {
+                    this->deferred_last->next = n;
+                    this->deferred_last       = n;
+                }
+            }
+
+            //Pushes an already linked chain of n tasks onto a lane, newest first
+            inline void enqueue( priority p, detail::TaskNode *first, detail::TaskNode *last, size_t n = 1 ) noexcept {
+                this->queued_tasks.fetch_add( n, std::memory_order_relaxed );
+
+                this->ring( this->lane( p ).queue.push( first, last ));
+            }
+
+            inline void enqueue( priority p, detail::TaskNode *task ) noexcept {
+                this->enqueue( p, task, task );
+            }
+
+            /*
+             * Takes a task back out of whichever lane it's queued on, without running it. Only for the loop thread,
+             * or while the loop isn't running at all.
+             * */
+            void unlink_task( detail::TaskNode *task ) noexcept {
+                for( detail::TaskLane &l : this->lanes ) {
+                    if( l.remove( task )) {
+                        this->queued_tasks.fetch_sub( 1, std::memory_order_relaxed );
+
+                        return;
+                    }
+                }
+            }
+
+            //Only wakes up the loop when the queue goes from empty to not empty and it isn't already draining
+            inline void ring( bool was_empty ) noexcept {
+                if( was_empty && !this->draining && !this->spinning && !this->internal_closed ) {
+                    uv_async_send( &this->doorbell );
+                }
+
+                this->unpark();
+            }
+
+            inline void unpark() noexcept {
+                if( this->parked ) {
+                    std::lock_guard<std::mutex> lock( this->park_mutex );
+
+                    this->park_cv.notify_one();
+                }
+            }
+
+            //Blocks the loop thread until there is a task to run or the loop is stopped
+            inline void park() {
+                std::unique_lock<std::mutex> lock( this->park_mutex );
+
+                this->parked = true;
+
+                this->park_cv.wait( lock, [this] {
+                    return this->stopped || this->deferred_first != nullptr || this->has_pending_tasks() ||
+                           !this->idle_lane.queue.empty();
+                } );
+
+                this->parked = false;
+            }
+
+            inline void _stop() {
+                stopped = true;
+
+                uv_stop( handle());
+
+                this->unpark();
+            }
+
+            inline bool is_internal( const uv_handle_t *h ) const noexcept {
+                return h == (const uv_handle_t *)&this->doorbell ||
+                       h == (const uv_handle_t *)&this->idle_probe ||
+                       h == (const uv_handle_t *)&this->idle_keepalive ||
+                       h == (const uv_handle_t *)&this->slice_check ||
+                       h == (const uv_handle_t *)&this->slice_keepalive;
+            }
+
+            /*
+             * The loop's own handles are never closed otherwise, so uv_loop_close would always fail because of them.
+             * They're only closed once nothing else is left, since the loop can't take any more tasks afterwards.
+             * Their close callbacks are flushed with one non-blocking run. Returns UV_EBUSY if anything else is
+             * still open, registered or in flight.
+             * */
+            int close_internal() noexcept {
+                if( this->internal_closed ) {
+                    return 0;
+                }
+
+                struct walk_state {
+                    Loop *self;
+                    bool busy;
+                } state = { this, this->registry.size() != 0 };
+
+                //Handles libuv knows about but uv++ doesn't count too
+                uv_walk( this->handle(), []( uv_handle_t *h, void *arg ) {
+                    walk_state *st = static_cast<walk_state *>(arg);
+
+                    if( !st->self->is_internal( h ) && !uv_is_closing( h )) {
+                        st->busy = true;
+                    }
+                }, &state );
+
+                if( state.busy ) {
+                    return UV_EBUSY;
+                }
+
+                uv_close((uv_handle_t *)&this->doorbell, nullptr );
+                uv_close((uv_handle_t *)&this->idle_probe, nullptr );
+                uv_close((uv_handle_t *)&this->idle_keepalive, nullptr );
+                uv_close((uv_handle_t *)&this->slice_check, nullptr );
+                uv_close((uv_handle_t *)&this->slice_keepalive, nullptr );
+
+                this->internal_closed = true;
+
+                //A uv_stop from outside of uv_run is still pending and ends the first run before any close callbacks
+                while( uv_run( this->handle(), UV_RUN_NOWAIT ) != 0 ) {
+                }
+
+                return 0;
+            }
+
+            //Gets the Loop back from inside a raw libuv callback
+            static Loop *from_uv( uv_loop_t *l ) noexcept {
+                std::weak_ptr<HandleData> *d = static_cast<std::weak_ptr<HandleData> *>(l->data);
+
+                if( d != nullptr ) {
+                    if( auto data = d->lock()) {
+                        if( auto self = data->self.lock()) {
+                            return self.get();
+                        }
+                    }
+                }
+
+                return nullptr;
+            }
+
+            /*
+             * Closes every handle on the loop in one pass with uv_walk, using one shared close callback and a
+             * counter instead of a continuation and future per handle. The loop's own handles are left open so tasks
+             * can still be scheduled afterwards.
+             * */
+            void begin_close_all( std::function<void()> done ) {
+                assert( this->on_loop_thread());
+
+                this->bulk_close_waiters.push_back( std::move( done ));
+
+                //Already going, so just wait along with everyone else
+                if( this->bulk_close_waiters.size() > 1 ) {
+                    return;
+                }
+
+                this->close_all_count.fetch_add( 1, std::memory_order_relaxed );
+
+                //So Handle::close and handle destructors keep their hands off while this is going on
+                this->registry.mark_closing();
+
+                uv_walk( this->handle(), []( uv_handle_t *h, void *arg ) {
+                    Loop *self = static_cast<Loop *>(arg);
+
+                    if( !self->is_internal( h ) && !uv_is_closing( h )) {
+                        ++self->bulk_closing;
+
+                        uv_close( h, &Loop::on_bulk_closed );
+                    }
+                }, this );
+
+                if( this->bulk_closing == 0 ) {
+                    this->finish_close_all();
+                }
+            }
+
+            static void on_bulk_closed( uv_handle_t *h ) {
+                Loop *self = Loop::from_uv( h->loop );
+
+                if( self != nullptr && --self->bulk_closing == 0 ) {
+                    self->finish_close_all();
+                }
+            }
+
+            void finish_close_all() {
+                this->registry.remove_handles();
+
+                //The metrics timer went with everything else, so there is no lag to measure against anymore
+                if( this->metrics_timer && !this->metrics_timer->is_active()) {
+                    this->metrics_timer.reset();
+
+                    this->next_sample_ns.store( 0, std::memory_order_relaxed );
+                }
+
+                std::vector<std::function<void()>> waiters;
+
+                waiters.swap( this->bulk_close_waiters );
+
+                for( auto &f : waiters ) {
+                    f();
+                }
+            }
+
+        public:
+            inline const handle_t *handle() const noexcept {
+                return _handle.get();
+            }
+
+            inline handle_t *handle() noexcept {
+                return _handle.get();
+            }
+
+        private:
+            explicit inline Loop()
+                : external( false ),
+                  stopped( false ),
+                  has_ran( false ),
+                  bulk_closing( 0 ),
+                  close_all_count( 0 ),
+                  internal_closed( false ),
+                  virtual_clock( false ),
+                  virtual_now( 0 ),
+                  virtual_seq( 0 ),
+                  idle_queued( 0 ),
+                  idle_tasks_run_count( 0 ),
+                  sliced_first( nullptr ),
+                  sliced_last( nullptr ),
+                  sliced_count( 0 ),
+                  deferred_first( nullptr ),
+                  deferred_last( nullptr ),
+                  parked( false ),
+                  spinning( false ),
+                  spin_hit_count( 0 ),
+                  blocking_wakeup_count( 0 ),
+                  queued_tasks( 0 ),
+                  drain_budget_hits( 0 ),
+                  current_task( nullptr ),
+                  doorbell_count( 0 ),
+                  drain_count( 0 ),
+                  tasks_run_count( 0 ),
+                  iteration_count( 0 ),
+                  idle_ns( 0 ),
+                  busy_ns( 0 ),
+                  lag_ns( 0 ),
+                  max_lag_ns( 0 ),
+                  metrics_started( 0 ),
+                  last_sample( 0 ),
+                  metrics_interval_ns( 0 ),
+                  metrics_idle_base( 0 ),
+                  next_sample_ns( 0 ),
+                  max_queue_depth( 0 ),
+                  max_lag_allowed_ns( 0 ),
+                  rejected_depth_count( 0 ),
+                  rejected_lag_count( 0 ),
+                  _loop_thread( std::this_thread::get_id()) {
+                using namespace std::chrono_literals;
+
+                this->drain_budget( UV_DRAIN_BUDGET_TASKS, UV_DRAIN_BUDGET_TIME );
+
+                this->spin_budget( UV_SPIN_BUDGET );
+
+                this->idle_slice( UV_IDLE_SLICE );
+
+                this->time_slice( UV_TIME_SLICE );
+            }
+
+        public:
+            /*
+             * Snapshot of how busy the loop is. Every field can be read from any thread without locking.
+             *
+             * Iterations, idle/busy time and lag are only filled in by enable_metrics, and are as of the last sample.
+             * Idle time is time spent waiting in poll, which needs libuv 1.39 or newer.
+             * */
+            struct Metrics {
+                uint64_t iterations;
+
+                std::chrono::nanoseconds idle_time;
+                std::chrono::nanoseconds busy_time;
+
+                //Scheduled tasks waiting to run, and how many have run so far over how many drains
+                size_t   queue_depth;
+                uint64_t tasks_run;
+                uint64_t drains;
+
+                //Idle tasks waiting to run, and how many have run so far
+                size_t   idle_queue_depth;
+                uint64_t idle_tasks_run;
+
+                //Sliced tasks that haven't finished yet
+                size_t sliced_tasks;
+
+                //Times the scheduler's async handle woke up the loop
+                uint64_t async_wakeups;
+
+                uint64_t budget_hits;
+                uint64_t spin_hits;
+                uint64_t blocking_wakeups;
+
+                //Handles and requests the loop is tracking, and how many it has released
+                size_t registered;
+                size_t reclaimed;
+
+                //How late the metrics timer fired last time, and the worst it has ever been
+                std::chrono::nanoseconds lag;
+                std::chrono::nanoseconds max_lag;
+
+                //Tasks turned away by admission control for a full queue, and for too much lag
+                uint64_t rejected_depth;
+                uint64_t rejected_lag;
+            };
+
+            Loop( const Loop & ) = delete;
+
+            //TODO: Figure out move semantics with atomic values
+            //Loop( Loop && ) = delete;
+
+            static inline std::shared_ptr<Loop> make_loop( handle_t *l = nullptr ) {
+                auto loop = std::shared_ptr<Loop>( new Loop());
+
+                if( l == nullptr ) {
+                    loop->_handle = std::make_shared<handle_t>();
+
+                } else {
+
+                    struct no_deleter {
+                        void operator()( handle_t *p ) const {
+                        };
+                    };
+
+                    loop->_handle = std::shared_ptr<handle_t>( l, no_deleter());
+
+                    loop->external = true;
+                }
+
+                loop->init( loop->shared_from_this());
+
+                return loop;
+            }
+
+            inline std::shared_ptr<fs::Filesystem> fs() noexcept {
+                return _fs;
+            }
+
+            inline int run( run_mode mode = RUN_DEFAULT ) noexcept {
+                assert( mode != RUN_SPIN );
+
+                this->stopped = false;
+
+                this->_loop_thread = std::this_thread::get_id();
+
+                this->has_ran = true;
+
+                return uv_run( this->handle(), (uv_run_mode)( mode ));
+            }
+
+            //Polling version of run_forever, which sleeps for delay whenever uv_run returns with nothing to do
+            template <typename _Rep, typename _Period>
+            void run_forever( const std::chrono::duration<_Rep, _Period> &delay, run_mode mode = RUN_DEFAULT ) noexcept {
+                this->stopped = false;
+
+#ifdef UV_DETRACT_LOOP
+                typedef std::chrono::nanoseconds                       nano;
+                typedef std::chrono::high_resolution_clock::time_point time_point;
+
+                nano delay_ns = std::chrono::duration_cast<nano>( delay );
+                nano detract  = std::chrono::duration_values<nano>::zero();
+                nano diff;
+
+                time_point pre, post;
+
+                while( !this->stopped ) {
+                    if(( !this->run( mode ) || mode == RUN_NOWAIT ) && detract < delay_ns ) {
+                        pre = std::chrono::high_resolution_clock::now();
+
+                        std::this_thread::sleep_for( delay_ns - detract );
+
+                        post = std::chrono::high_resolution_clock::now();
+
+                        diff = post - pre;
+
+                        if( diff > delay_ns ) {
+                            detract = diff - delay_ns;
+
+                        } else {
+                            detract = std::chrono::duration_values<nano>::zero();
+                        }
+                    }
+                }
+#else
+                while( !this->stopped ) {
+                    if( this->run( mode ) == 0 || mode == RUN_NOWAIT ) {
+                        std::this_thread::sleep_for( delay );
+                    }
+                }
+#endif
+            }
+
+            /*
+             * Runs the loop until it's stopped, without any timed sleeps.
+             *
+             * When libuv runs out of active handles and requests, the loop thread parks until something is
+             * scheduled onto it (which includes creating a handle from another thread) or the loop is stopped.
+             * With RUN_NOWAIT, each non-blocking pass is followed by one blocking pass instead of a sleep.
+             * */
+            inline void run_forever( run_mode mode = RUN_DEFAULT ) {
+                if( mode == RUN_SPIN ) {
+                    this->run_spinning();
+
+                    return;
+                }
+
+                this->stopped = false;
+
+                //The doorbell shouldn't keep the loop alive by itself here, since parking takes care of that
+                uv_unref((uv_handle_t *)&this->doorbell );
+
+                while( !this->stopped ) {
+                    int alive = this->run( mode );
+
+                    if( this->stopped ) {
+                        break;
+
+                    } else if( alive == 0 ) {
+                        this->park();
+
+                        //uv_run won't look at an unreferenced doorbell on a loop with nothing else alive
+                        if( !this->stopped && ( this->deferred_first != nullptr || this->has_pending_tasks() ||
+                                                !this->idle_lane.queue.empty())) {
+                            this->drain_tasks();
+                        }
+
+                    } else if( mode == RUN_NOWAIT ) {
+                        this->run( RUN_ONCE );
+                    }
+                }
+
+                uv_ref((uv_handle_t *)&this->doorbell );
+            }
+
+        protected:
+            /*
+             * Busy-polls the loop and the task queues, falling back to blocking in the backend once nothing has
+             * shown up for the length of the spin window.
+             *
+             * The window adapts to how often tasks actually arrive. If they come in faster than the spin budget,
+             * it spins a bit longer than the average gap between them. Otherwise spinning is mostly wasted, so the
+             * window shrinks down to almost nothing and the loop blocks right away.
+             * */
+            void run_spinning() {
+                this->stopped      = false;
+                this->_loop_thread = std::this_thread::get_id();
+                this->has_ran      = true;
+
+                const uint64_t min_window = 1000; //1us
+
+                uint64_t max_window = this->spin_budget_ns.load( std::memory_order_relaxed );
+                uint64_t window     = max_window;
+                uint64_t avg_gap    = max_window;
+                uint64_t last_hit   = uv_hrtime();
+                uint64_t spin_start = last_hit;
+
+                this->spinning = true;
+
+                while( !this->stopped ) {
+                    uv_run( this->handle(), UV_RUN_NOWAIT );
+
+                    if( this->deferred_first != nullptr || this->has_pending_tasks()) {
+                        const uint64_t now = uv_hrtime();
+
+                        //Exponentially weighted moving average of the time between arrivals
+                        avg_gap  = ( avg_gap * 7 + ( now - last_hit )) / 8;
+                        last_hit = now;
+
+                        max_window = this->spin_budget_ns.load( std::memory_order_relaxed );
+                        window     = avg_gap > max_window ? min_window
+                                                          : detail::clamp<uint64_t>( avg_gap * 2, min_window,
+                                                                                     max_window );
+
+                        this->spin_hit_count.fetch_add( 1, std::memory_order_relaxed );
+
+                        this->drain_tasks();
+
+                        spin_start = uv_hrtime();
+
+                    } else if( uv_hrtime() - spin_start >= window ) {
+                        this->spinning = false;
+
+                        //Anything pushed before spinning was cleared didn't ring the doorbell
+                        if( !this->has_pending_tasks() && this->deferred_first == nullptr ) {
+                            this->blocking_wakeup_count.fetch_add( 1, std::memory_order_relaxed );
+
+                            uv_run( this->handle(), UV_RUN_ONCE );
+                        }
+
+                        this->spinning = true;
+
+                        spin_start = uv_hrtime();
+                    }
+                }
+
+                this->spinning = false;
+            }
+
+        public:
+            inline void start( run_mode mode = RUN_DEFAULT ) {
+                this->run_forever( mode );
+            }
+
+            template <typename... Args>
+            typename std::enable_if<detail::all_type<uv_loop_option, Args...>::value, Loop &>::type
+            configure( Args &&... args ) {
+                assert( this->on_loop_thread());
+
+                auto res = uv_loop_configure( this->handle(), std::forward<Args>( args )... );
+
+                if( res != 0 ) {
+                    throw Exception( res );
+                }
+
+                return *this;
+            }
+
+            /*
+             * Limits how many scheduled tasks are run per loop iteration, by count and/or by time. Zero means no
+             * limit for either one. Can be changed from any thread.
+             *
+             * The time limit is checked between tasks, so a single slow task can still go over it.
+             * */
+            template <typename _Rep = uint64_t, typename _Period = std::nano>
+            inline Loop &drain_budget( size_t max_tasks,
+                                       const std::chrono::duration<_Rep, _Period> &max_time =
+                                       std::chrono::duration<_Rep, _Period>(
+                                           std::chrono::duration_values<_Rep>::zero())) noexcept {
+                this->drain_budget_tasks = max_tasks;
+                this->drain_budget_ns    = std::chrono::duration_cast<std::chrono::nanoseconds>( max_time ).count();
+
+                return *this;
+            }
+
+            //Scheduled tasks that haven't run yet. Approximate, since producers can be pushing at the same time.
+            inline size_t pending_tasks() const noexcept {
+                return this->queued_tasks.load( std::memory_order_relaxed );
+            }
+
+            /*
+             * Limits for try_schedule and try_post. Once more than max_depth tasks are waiting, or the loop is
+             * lagging by more than max_lag, new tasks are turned away instead of queued. Zero turns either limit
+             * off. Can be changed from any thread.
+             *
+             * Lag is measured off the metrics timer, so the lag limit only does anything while metrics are enabled,
+             * and never on virtual time.
+             * A stuck loop thread counts as lagging even before the timer gets a chance to notice.
+             * */
+            template <typename _Rep = uint64_t, typename _Period = std::nano>
+            inline Loop &admission_limits( size_t max_depth,
+                                           const std::chrono::duration<_Rep, _Period> &max_lag =
+                                           std::chrono::duration<_Rep, _Period>(
+                                               std::chrono::duration_values<_Rep>::zero())) noexcept {
+                this->max_queue_depth    = max_depth;
+                this->max_lag_allowed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( max_lag ).count();
+
+                return *this;
+            }
+
+            /*
+             * Lag as of right now, including how overdue the metrics timer is if the loop is stuck. Zero whenever the
+             * metrics timer isn't running, since then there's nothing to measure against.
+             * */
+            inline std::chrono::nanoseconds current_lag() const noexcept {
+                uint64_t due = this->next_sample_ns.load( std::memory_order_relaxed );
+
+                if( due == 0 ) {
+                    return std::chrono::nanoseconds( 0 );
+                }
+
+                uint64_t lag = this->lag_ns.load( std::memory_order_relaxed );
+                uint64_t t   = uv_hrtime();
+
+                if( t > due && t - due > lag ) {
+                    lag = t - due;
+                }
+
+                return std::chrono::nanoseconds( lag );
+            }
+
+            //Whether try_schedule and try_post would turn a task away right now
+            inline bool overloaded() const noexcept {
+                const size_t   max_depth = this->max_queue_depth.load( std::memory_order_relaxed );
+                const uint64_t max_lag   = this->max_lag_allowed_ns.load( std::memory_order_relaxed );
+
+                return ( max_depth != 0 && this->pending_tasks() >= max_depth ) ||
+                       ( max_lag != 0 && (uint64_t)this->current_lag().count() > max_lag );
+            }
+
+            //Total tasks turned away by admission control
+            inline uint64_t rejected() const noexcept {
+                return this->rejected_depth_count.load( std::memory_order_relaxed ) +
+                       this->rejected_lag_count.load( std::memory_order_relaxed );
+            }
+
+            //Idle tasks that haven't run yet
+            inline size_t pending_idle_tasks() const noexcept {
+                return this->idle_queued.load( std::memory_order_relaxed );
+            }
+
+            /*
+             * Longest the loop runs idle tasks in one go before going back to poll for I/O. Can be changed from any
+             * thread. Checked between tasks, and at least one always runs.
+             * */
+            template <typename _Rep, typename _Period>
+            inline Loop &idle_slice( const std::chrono::duration<_Rep, _Period> &slice ) noexcept {
+                this->idle_slice_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( slice ).count();
+
+                return *this;
+            }
+
+            //Sliced tasks that haven't finished yet
+            inline size_t sliced_tasks() const noexcept {
+                return this->sliced_count.load( std::memory_order_relaxed );
+            }
+
+            //Time all sliced tasks get per loop iteration. Can be changed from any thread.
+            template <typename _Rep, typename _Period>
+            inline Loop &time_slice( const std::chrono::duration<_Rep, _Period> &slice ) noexcept {
+                this->time_slice_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( slice ).count();
+
+                return *this;
+            }
+
+            //Upper limit on how long RUN_SPIN busy-polls before blocking. Can be changed from any thread.
+            template <typename _Rep, typename _Period>
+            inline Loop &spin_budget( const std::chrono::duration<_Rep, _Period> &max_spin ) noexcept {
+                this->spin_budget_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( max_spin ).count();
+
+                return *this;
+            }
+
+            //Times RUN_SPIN found scheduled tasks while busy-polling
+            inline uint64_t spin_hits() const noexcept {
+                return this->spin_hit_count.load( std::memory_order_relaxed );
+            }
+
+            //Times RUN_SPIN gave up spinning and blocked
+            inline uint64_t blocking_wakeups() const noexcept {
+                return this->blocking_wakeup_count.load( std::memory_order_relaxed );
+            }
+
+            //Number of times the drain budget ran out with scheduled tasks still waiting
+            inline uint64_t budget_hits() const noexcept {
+                return this->drain_budget_hits.load( std::memory_order_relaxed );
+            }
+
+            /*
+             * Starts sampling idle time, iteration count and event loop lag every interval. Can be called from any
+             * thread.
+             *
+             * The sampling timer counts as an active handle, so a plain run() won't return while metrics are
+             * enabled. An unreferenced timer would never fire while run_forever is parked, which is also exactly
+             * when the numbers matter least, but they'd go stale.
+             * */
+            template <typename _Rep, typename _Period>
+            Loop &enable_metrics( const std::chrono::duration<_Rep, _Period> &interval ) {
+                uint64_t interval_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>( interval ).count();
+
+                this->dispatch( [interval_ns]( std::shared_ptr<Loop> self ) {
+                    if( self->metrics_timer ) {
+                        self->metrics_timer->close( [] {} );
+                    }
+
+#if UV_VERSION_HEX >= 0x012700
+                    try {
+                        self->configure( UV_METRICS_IDLE_TIME );
+
+                    } catch( const Exception & ) {
+                        //Idle time just stays at zero then, there's nowhere to report this from here
+                    }
+
+                    self->metrics_idle_base = uv_metrics_idle_time( self->handle());
+#endif
+
+#if UV_VERSION_HEX < 0x012D00
+                    if( !self->iteration_counter ) {
+                        Loop *l = self.get();
+
+                        self->iteration_counter = self->prepare( [l] {
+                            bump( l->iteration_count );
+                        } );
+
+                        self->iteration_counter->unref();
+                    }
+#endif
+
+                    self->metrics_interval_ns = interval_ns;
+                    self->metrics_started     = self->last_sample = uv_hrtime();
+
+                    if( !self->virtual_clock ) {
+                        self->next_sample_ns.store( self->last_sample + interval_ns, std::memory_order_relaxed );
+                    }
+
+                    Loop *l = self.get();
+
+                    self->metrics_timer = self->timer( [l] {
+                        l->sample_metrics();
+                    }, std::chrono::nanoseconds( interval_ns ), std::chrono::nanoseconds( interval_ns ));
+
+                }, this->shared_from_this());
+
+                return *this;
+            }
+
+            Loop &disable_metrics() {
+                this->dispatch( []( std::shared_ptr<Loop> self ) {
+                    if( self->metrics_timer ) {
+                        self->metrics_timer->close( [] {} );
+                        self->metrics_timer.reset();
+                    }
+
+                    self->next_sample_ns.store( 0, std::memory_order_relaxed );
+                }, this->shared_from_this());
+
+                return *this;
+            }
+
+            inline Loop &enable_metrics() {
+                using namespace std::chrono_literals;
+
+                return this->enable_metrics( UV_METRICS_INTERVAL );
+            }
+
+            Metrics metrics() const noexcept {
+                Metrics m;
+
+                m.iterations       = this->iteration_count.load( std::memory_order_relaxed );
+                m.idle_time        = std::chrono::nanoseconds( this->idle_ns.load( std::memory_order_relaxed ));
+                m.busy_time        = std::chrono::nanoseconds( this->busy_ns.load( std::memory_order_relaxed ));
+                m.queue_depth      = this->pending_tasks();
+                m.tasks_run        = this->tasks_run_count.load( std::memory_order_relaxed );
+                m.drains           = this->drain_count.load( std::memory_order_relaxed );
+                m.idle_queue_depth = this->pending_idle_tasks();
+                m.idle_tasks_run   = this->idle_tasks_run_count.load( std::memory_order_relaxed );
+                m.sliced_tasks     = this->sliced_tasks();
+                m.async_wakeups    = this->doorbell_count.load( std::memory_order_relaxed );
+                m.budget_hits      = this->budget_hits();
+                m.spin_hits        = this->spin_hits();
+                m.blocking_wakeups = this->blocking_wakeups();
+                m.registered       = this->registered();
+                m.reclaimed        = this->reclaimed();
+                m.lag              = std::chrono::nanoseconds( this->lag_ns.load( std::memory_order_relaxed ));
+                m.max_lag          = std::chrono::nanoseconds( this->max_lag_ns.load( std::memory_order_relaxed ));
+                m.rejected_depth   = this->rejected_depth_count.load( std::memory_order_relaxed );
+                m.rejected_lag     = this->rejected_lag_count.load( std::memory_order_relaxed );
+
+                return m;
+            }
+
+            /*
+             * The run function of the scheduled task currently running on the loop thread, or nullptr if it isn't
+             * running one. Every kind of task has its own run function, so this is enough to look up what it is.
+             * */
+            inline const void *running_task() const noexcept {
+                return this->current_task.load( std::memory_order_relaxed );
+            }
+
+            inline static size_t size() noexcept {
+                return uv_loop_size();
+            }
+
+            inline int backend_fd() const noexcept {
+                assert( this->on_loop_thread());
+
+                return uv_backend_fd( handle());
+            }
+
+            inline int backend_timeout() const noexcept {
+                assert( this->on_loop_thread());
+
+                return uv_backend_timeout( handle());
+            }
+
+            /*
+             * Hands the loop over to another event loop running on the calling thread, instead of giving it a
+             * thread of its own. Returns the backend fd, which the host should watch for readability.
+             *
+             * From then on, the host calls poll_once whenever the fd is readable or the timeout it last returned
+             * runs out. Tasks scheduled from other threads ring the doorbell, which makes the backend fd readable,
+             * so nothing extra is needed to wake the host up.
+             *
+             * The backend fd is epoll/kqueue/event port based, so this doesn't work on Windows, where it's -1.
+             * */
+            inline int embed() noexcept {
+                this->stopped      = false;
+                this->_loop_thread = std::this_thread::get_id();
+
+                //Handles created from other threads now get started by the host thread instead of racing it
+                this->has_ran = true;
+
+                return uv_backend_fd( this->handle());
+            }
+
+            /*
+             * Runs one non-blocking iteration of the loop, including any scheduled tasks that have come in, and
+             * returns how long the host can wait on the backend fd before calling this again, in milliseconds.
+             * -1 means until the fd is readable, and 0 means call it again right away.
+             * */
+            inline int poll_once() noexcept {
+                this->_loop_thread = std::this_thread::get_id();
+
+                uv_run( this->handle(), UV_RUN_NOWAIT );
+
+                return this->next_timeout();
+            }
+
+            //backend_timeout, except that tasks already waiting to run mean there's no time to wait
+            inline int next_timeout() const noexcept {
+                assert( this->on_loop_thread());
+
+                if( this->deferred_first != nullptr || this->has_pending_tasks()) {
+                    return 0;
+                }
+
+                return uv_backend_timeout( this->handle());
+            }
+
+            inline uint64_t now() const noexcept {
+                return this->virtual_clock ? this->virtual_now : uv_now( handle());
+            }
+
+            //Does nothing on virtual time, where only advance moves the clock
+            inline void update_time() noexcept {
+                if( !this->virtual_clock ) {
+                    uv_update_time( handle());
+                }
+            }
+
+            /*
+             * Switches the loop over to a virtual clock, starting from the current time. Must be called on the loop
+             * thread before any timers are started, and can't be undone.
+             *
+             * From then on, now() only moves when advance or advance_to_next is called, and timers are kept by
+             * uv++ instead of libuv. They fire in deadline order, ties in the order they were started, with no
+             * real waiting at all, so hours of timer traffic can be replayed in however long the callbacks take.
+             *
+             * Virtual timers don't keep the loop alive, so drive it with advance instead of run. Everything else on
+             * the loop (I/O, the thread pool) still runs on real time.
+             * */
+            inline Loop &use_virtual_time() noexcept {
+                assert( this->on_loop_thread());
+
+                if( !this->virtual_clock ) {
+                    uv_update_time( this->handle());
+
+                    this->virtual_now   = uv_now( this->handle());
+                    this->virtual_clock = true;
+
+                    //The metrics timer won't fire on real time anymore, so stop measuring lag off of it
+                    this->next_sample_ns.store( 0, std::memory_order_relaxed );
+                }
+
+                return *this;
+            }
+
+            inline bool is_virtual_time() const noexcept {
+                return this->virtual_clock;
+            }
+
+            /*
+             * Moves the virtual clock forward by d, firing every timer that comes due along the way, each with the
+             * clock set to its own deadline. Scheduled tasks are run after every timer, so anything a callback
+             * posts happens before the next one fires. Returns how many timers fired.
+             *
+             * The clock only has millisecond resolution, so d is rounded up to the next whole millisecond. That way
+             * advancing by less than a millisecond still moves the clock instead of doing nothing.
+             * */
+            template <typename _Rep, typename _Period>
+            size_t advance( const std::chrono::duration<_Rep, _Period> &d ) {
+                assert( this->virtual_clock );
 
-                nano delay_ns = std::chrono::duration_cast<nano>( delay );
-                nano detract  = std::chrono::duration_values<nano>::zero();
-                nano diff;
+                std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>( d );
 
-                time_point pre, post;
+                if( ms < d ) {
+                    ++ms;
+                }
 
-                while( !this->stopped ) {
-                    if(( !this->run( mode ) || mode == RUN_NOWAIT ) && detract < delay_ns ) {
-                        pre = std::chrono::high_resolution_clock::now();
+                const uint64_t target = this->virtual_now + (uint64_t)ms.count();
 
-                        std::this_thread::sleep_for( delay_ns - detract );
+                size_t fired = this->fire_virtual_timers( target );
 
-                        post = std::chrono::high_resolution_clock::now();
+                this->virtual_now = target;
 
-                        diff = post - pre;
+                return fired;
+            }
 
-                        if( diff > delay_ns ) {
-                            detract = diff - delay_ns;
+            //Jumps straight to the next virtual timer deadline and fires everything due then. False if there are none.
+            bool advance_to_next() {
+                assert( this->virtual_clock );
 
-                        } else {
-                            detract = std::chrono::duration_values<nano>::zero();
-                        }
-                    }
-                }
-#else
-                while( !this->stopped ) {
-                    if( this->run( mode ) == 0 || mode == RUN_NOWAIT ) {
-                        std::this_thread::sleep_for( delay );
+                while( !this->virtual_timers.empty()) {
+                    if( this->fire_virtual_timers( this->virtual_timers.front().deadline ) != 0 ) {
+                        return true;
                     }
                 }
-#endif
+
+                return false;
             }
 
-            inline void run_forever( run_mode mode = RUN_DEFAULT ) noexcept {
-                using namespace std::chrono_literals;
+            /*
+             * Handles and requests currently registered with the loop. Closed handles and finished requests are
+             * released right away, so under a steady load this should stay flat.
+             * */
+            inline size_t registered() const noexcept {
+                return this->registry.size();
+            }
 
-                this->run_forever( UV_DEFAULT_LOOP_SLEEP, mode );
+            //Handles and requests the loop has let go of so far
+            inline size_t reclaimed() const noexcept {
+                return this->registry.removed();
             }
 
-            inline void start( run_mode mode = RUN_DEFAULT ) noexcept {
-                this->run_forever( mode );
+            /*
+             * Closes every handle on the loop, including ones libuv knows about but uv++ doesn't, and releases them
+             * all from the registry. The future resolves once every close callback has run.
+             *
+             * Handles closed this way don't get their own close callbacks, and calling close on them afterwards gives
+             * an exception future like any other closed handle. Can be called from any thread.
+             * */
+            std::shared_future<void> close_all() {
+                auto done = std::make_shared<std::promise<void>>();
+
+                this->dispatch( []( std::shared_ptr<Loop> self, std::shared_ptr<std::promise<void>> inner ) {
+                    self->begin_close_all( [inner] {
+                        inner->set_value();
+                    } );
+                }, this->shared_from_this(), done );
+
+                return done->get_future().share();
             }
 
-            template <typename... Args>
-            typename std::enable_if<detail::all_type<uv_loop_option, Args...>::value, Loop &>::type
-            configure( Args &&... args ) {
-                assert( this->on_loop_thread());
+            //Same as close_all, but also stops the loop once everything is closed. close() can follow right after.
+            std::shared_future<void> shutdown() {
+                auto done = std::make_shared<std::promise<void>>();
 
-                auto res = uv_loop_configure( this->handle(), std::forward<Args>( args )... );
+                this->dispatch( []( std::shared_ptr<Loop> self, std::shared_ptr<std::promise<void>> inner ) {
+                    Loop *l = self.get();
 
-                if( res != 0 ) {
-                    throw Exception( res );
-                }
+                    self->begin_close_all( [l, inner] {
+                        l->stop();
 
-                return *this;
+                        inner->set_value();
+                    } );
+                }, this->shared_from_this(), done );
+
+                return done->get_future().share();
             }
 
-            inline static size_t size() noexcept {
-                return uv_loop_size();
+            /*
+             * Kept for compatibility. There is nothing left to sweep, since every entry unlinks itself when it's
+             * closed, finished or destroyed.
+             * */
+            inline void cleanup() noexcept {
             }
 
-            inline int backend_fd() const noexcept {
-                assert( this->on_loop_thread());
+            /*
+             * Call in a forked child before using the loop at all. Reinitializes the backend with uv_loop_fork and
+             * resets everything uv++ keeps about threads, since the calling thread is the only one the child has.
+             *
+             * The loop thread becomes the calling thread, and locks other threads might have held at fork time are
+             * replaced. Handles, timers and scheduled tasks carry over, so anything still queued at fork time runs
+             * in the child as well. LoopGroup and Watchdog threads don't survive a fork, so make them in the child.
+             *
+             * Needs libuv 1.12 or newer, and throws otherwise.
+             * */
+            void after_fork() {
+#if UV_VERSION_HEX >= 0x010C00
+                new( &this->park_mutex ) std::mutex();
+                new( &this->park_cv ) std::condition_variable();
+                new( &this->init_mutex ) std::mutex();
 
-                return uv_backend_fd( handle());
-            }
+                this->registry.after_fork();
 
-            inline int backend_timeout() const noexcept {
-                assert( this->on_loop_thread());
+                this->_loop_thread = std::this_thread::get_id();
 
-                return uv_backend_timeout( handle());
-            }
+                this->stopped  = false;
+                this->parked   = false;
+                this->spinning = false;
+                this->draining = false;
 
-            inline uint64_t now() const noexcept {
-                return uv_now( handle());
-            }
+                this->current_task = nullptr;
 
-            inline void update_time() noexcept {
-                uv_update_time( handle());
-            }
+                int res = uv_loop_fork( this->handle());
 
-            void cleanup() {
-                std::lock_guard<std::mutex> lock( this->handle_mutex );
+                if( res != 0 ) {
+                    throw ::uv::Exception( res );
+                }
 
-                //TODO: Convert this to explicit loop
-                //std::remove_if( this->weak_handles.begin(), this->weak_handles.end(), []( const weak_handle_map::value_type &p ) -> bool {
-                //    return p.second.expired();
-                //} );
+                //Whatever rang the doorbell in the parent didn't ring it here
+                if( this->deferred_first != nullptr || this->has_pending_tasks() ||
+                    !this->idle_lane.queue.empty()) {
+                    uv_async_send( &this->doorbell );
+                }
+#else
+                throw ::uv::Exception( UV_ENOSYS );
+#endif
             }
 
-            //returns true on closed
+            /*
+             * returns true on closed
+             *
+             * Once every other handle is closed, this closes the loop's own handles as well, so it works right after
+             * shutdown. Nothing can be scheduled onto the loop after that.
+             * */
             inline bool try_close( int *resptr = nullptr ) noexcept {
                 assert( this->on_loop_thread());
 
-                int res = uv_loop_close( this->handle());
+                int res = this->close_internal();
+
+                if( res == 0 ) {
+                    res = uv_loop_close( this->handle());
+                }
 
                 if( resptr != nullptr ) {
                     *resptr = res;
@@ -308,45 +1778,62 @@ namespace uv {
             }
 
         protected:
+            template <typename H, typename D>
+            static inline void close_late( Handle<H, D> *h ) {
+                h->close( [] {} );
+            }
+
+            //Requests aren't closed, they just finish
+            static inline void close_late( ... ) noexcept {
+            }
+
             template <typename H, typename... Args>
             std::shared_ptr<H> new_handle( bool requires_loop_thread, bool weak, Args... args ) {
-                //The mutex prevents multiple initializations that affect the event loop at the same time
-                std::lock_guard<std::mutex> lock( this->handle_mutex );
+                std::shared_ptr<H> p = std::make_shared<H>();
+
+                this->registry.insert( &p->registry_hook, p, weak );
 
                 if( this->has_ran && requires_loop_thread && !this->on_loop_thread()) {
                     /*
-                     * If the new_handle request is not on the loop thread, block until everything is initialized there
-                     *
-                     * Not the best solution, but it just has to wait it's turn I guess. **shrugs**
+                     * Not on the loop thread, so hand back the handle right away and let the loop thread initialize
+                     * and start it whenever it gets to it. Anything done with the handle in the meantime goes
+                     * through when_ready, which queues it up behind this in the same lane.
                      * */
-                    return this->schedule( []( std::shared_ptr<Loop> self, bool inner_weak, Args... inner_args ) {
-                        assert( self->on_loop_thread());
+                    p->attach( this->shared_from_this());
 
-                        return self->new_handle<H>( false, inner_weak, std::forward<Args>( inner_args )... );
-                    }, weak, std::forward<Args>( args )... ).get();
+                    p->pre_start( args... );
 
-                } else {
-                    std::shared_ptr<H> p = std::make_shared<H>();
+                    const uint64_t closes = this->close_all_count.load( std::memory_order_relaxed );
 
-                    if( weak ) {
-                        auto it_inserted = weak_handles.emplace( weak_handle_map::value_type{ p.get(), std::weak_ptr<void>( p ) } );
+                    this->post( [closes]( std::shared_ptr<H> inner, Args... inner_args ) {
+                        inner->init_on_loop();
 
-                        //There should be no collisions for new pointers, but yeah
-                        assert( it_inserted.second );
+                        //Ready first, so start itself isn't queued up as one of the early operations
+                        inner->mark_ready();
 
-                    } else {
-                        auto it_inserted = handles.insert( p );
+                        inner->start( std::forward<Args>( inner_args )... );
 
-                        //There should be no collisions for new pointers, but yeah
-                        assert( it_inserted.second );
-                    }
+                        //close_all couldn't get to it before, so it's closed now that it's a real handle
+                        if( inner->loop()->close_all_count.load( std::memory_order_relaxed ) != closes ) {
+                            close_late( inner.get());
+                        }
+                    }, p, std::forward<Args>( args )... );
+
+                } else {
+                    /*
+                     * Before the loop has run, any thread can get here, so they have to take turns touching the loop.
+                     * The loop thread isn't known yet then either, so this locks no matter which thread it is.
+                     * */
+                    std::lock_guard<std::mutex> lock( this->init_mutex );
 
                     p->init( this->shared_from_this());
 
-                    p->start( std::forward<Args>( args )... );
+                    p->mark_ready();
 
-                    return p;
+                    p->start( std::forward<Args>( args )... );
                 }
+
+                return p;
             }
 
         public:
@@ -443,36 +1930,181 @@ namespace uv {
             }
 
             template <typename Functor, typename... Args>
-            UV_DECLTYPE_AUTO schedule( Functor f, Args... args ) {
-                typedef detail::AsyncContinuation<Functor, Loop> Cont;
+            UV_DECLTYPE_AUTO schedule( priority p, Functor f, Args... args ) {
+                typedef detail::ScheduledContinuation<Functor, Loop> Cont;
 
                 Cont *c = new Cont( f );
 
                 auto ret = c->init( this->shared_from_this(), std::forward<Args>( args )... );
 
-                scheduled_task t{ c, []( void *vc ) {
-                    Cont *sc = static_cast<Cont *>(vc);
+                this->enqueue( p, c );
 
-                    sc->dispatch();
+                return ret;
+            }
 
-                    delete sc;
-                }};
+            template <typename Functor, typename std::enable_if<
+                !std::is_same<typename std::decay<Functor>::type, priority>::value, int>::type = 0,
+                      typename... Args>
+            inline UV_DECLTYPE_AUTO schedule( Functor f, Args... args ) {
+                return this->schedule( priority::NORMAL, f, std::forward<Args>( args )... );
+            }
 
-#ifdef UV_USE_BOOST_LOCKFREE
-                this->task_queue.push( t );
-#else
-                {
-                    //Only lock the duration of the push_back
-                    std::lock_guard<std::mutex> lock( this->schedule_mutex );
+            /*
+             * Like schedule, but doesn't return anything. Use this whenever the result would just be thrown away,
+             * since it skips the promise and future entirely.
+             * */
+            template <typename Functor, typename... Args>
+            inline void post( priority p, Functor &&f, Args &&... args ) {
+                this->enqueue( p, detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... ));
+            }
+
+            template <typename Functor, typename std::enable_if<
+                !std::is_same<typename std::decay<Functor>::type, priority>::value, int>::type = 0,
+                      typename... Args>
+            inline void post( Functor &&f, Args &&... args ) {
+                this->post( priority::NORMAL, std::forward<Functor>( f ), std::forward<Args>( args )... );
+            }
+
+            /*
+             * Same as schedule, unless the loop is over its admission limits, in which case nothing is queued and
+             * the future is already holding an exception. Callers should take that as a sign to back off.
+             * */
+            template <typename Functor, typename... Args>
+            UV_DECLTYPE_AUTO try_schedule( priority p, Functor f, Args... args ) {
+                typedef typename detail::ScheduledContinuation<Functor, Loop>::result_type result_type;
 
-                    this->task_queue.push_back( t );
+                if( !this->admit()) {
+                    return detail::make_exception_future<result_type>(
+                        ::uv::Exception( "loop is overloaded, task rejected" )).share();
                 }
-#endif
-                this->schedule_async->send_void();
+
+                return this->schedule( p, f, std::forward<Args>( args )... );
+            }
+
+            template <typename Functor, typename std::enable_if<
+                !std::is_same<typename std::decay<Functor>::type, priority>::value, int>::type = 0,
+                      typename... Args>
+            inline UV_DECLTYPE_AUTO try_schedule( Functor f, Args... args ) {
+                return this->try_schedule( priority::NORMAL, f, std::forward<Args>( args )... );
+            }
+
+            //Same as post, unless the loop is over its admission limits. Returns whether the task was queued.
+            template <typename Functor, typename... Args>
+            inline bool try_post( priority p, Functor &&f, Args &&... args ) {
+                if( !this->admit()) {
+                    return false;
+                }
+
+                this->post( p, std::forward<Functor>( f ), std::forward<Args>( args )... );
+
+                return true;
+            }
+
+            template <typename Functor, typename std::enable_if<
+                !std::is_same<typename std::decay<Functor>::type, priority>::value, int>::type = 0,
+                      typename... Args>
+            inline bool try_post( Functor &&f, Args &&... args ) {
+                return this->try_post( priority::NORMAL, std::forward<Functor>( f ), std::forward<Args>( args )... );
+            }
+
+            /*
+             * Runs the task right away if called on the loop thread, otherwise it's the same as post.
+             *
+             * Careful with this from inside callbacks that aren't reentrant.
+             * */
+            template <typename Functor, typename... Args>
+            inline void dispatch( Functor &&f, Args &&... args ) {
+                if( this->on_loop_thread()) {
+                    f( std::forward<Args>( args )... );
+
+                } else {
+                    this->post( std::forward<Functor>( f ), std::forward<Args>( args )... );
+                }
+            }
+
+            /*
+             * On the loop thread, the task goes onto a per-iteration microtask list instead of the shared queue,
+             * and runs once the currently executing callback has returned, without waiting for a full round trip
+             * through the task queue. From any other thread it's the same as post.
+             * */
+            template <typename Functor, typename... Args>
+            inline void defer( Functor &&f, Args &&... args ) {
+                auto task = detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... );
+
+                if( this->on_loop_thread()) {
+                    this->push_deferred( task );
+
+                } else {
+                    this->enqueue( priority::NORMAL, task );
+                }
+            }
+
+            /*
+             * Queues up a background task that only runs when the loop has nothing better to do, meaning libuv
+             * would otherwise block in poll and there are no scheduled tasks waiting. Good for things like trimming
+             * caches or compaction that should never get in the way of I/O.
+             *
+             * Idle tasks run in FIFO order, in slices of at most the idle slice length, and never past the next
+             * timer. Between slices the loop polls for I/O without blocking. Once they're all done the loop goes
+             * back to blocking normally.
+             *
+             * Keep each one short, since a single task can't be interrupted. Can be called from any thread.
+             * */
+            template <typename Functor, typename... Args>
+            UV_DECLTYPE_AUTO schedule_idle( Functor f, Args... args ) {
+                typedef detail::ScheduledContinuation<Functor, Loop> Cont;
+
+                Cont *c = new Cont( f );
+
+                auto ret = c->init( this->shared_from_this(), std::forward<Args>( args )... );
+
+                this->enqueue_idle( c );
 
                 return ret;
             }
 
+            //Like schedule_idle, but without the future
+            template <typename Functor, typename... Args>
+            inline void post_idle( Functor &&f, Args &&... args ) {
+                this->enqueue_idle( detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... ));
+            }
+
+            /*
+             * Runs a long task on the loop thread a piece at a time, so it doesn't hold up everything else.
+             *
+             * f is called as bool( Slice & ) once per loop iteration. It should do some work until slice.yield()
+             * says its time is up, save its place, and return true to be resumed next iteration, or return false
+             * once it's finished. Timers, I/O and scheduled tasks all get serviced in between. The returned future
+             * is ready when it finishes, or holds whatever it threw.
+             *
+             * All sliced tasks share one time slice per iteration, and take turns starting first. Can be called
+             * from any thread.
+             * */
+            template <typename Functor>
+            std::shared_future<void> spawn_sliced( Functor &&f ) {
+                SlicedTask *t = new SlicedTask();
+
+                t->fn = std::forward<Functor>( f );
+
+                std::shared_future<void> done = t->done.get_future().share();
+
+                this->dispatch( []( std::shared_ptr<Loop> self, SlicedTask *inner ) {
+                    self->add_sliced( inner );
+                }, this->shared_from_this(), t );
+
+                return done;
+            }
+
+            //Collects tasks locally and submits all of them with a single push and wakeup
+            TaskBatch batch( priority p = priority::NORMAL );
+
+            /*
+             * Posts every functor in [first, last) as one batch. The returned future is ready once all of them have
+             * run on the loop thread.
+             * */
+            template <typename Iterator>
+            std::shared_future<void> post_bulk( Iterator first, Iterator last );
+
             inline std::shared_ptr<Work> work( bool weak = false ) {
                 //Work is special since it doesn't initialize on the loop thread
                 return new_handle<Work>( false, weak );
@@ -546,6 +2178,119 @@ namespace uv {
             }
     };
 
+    /*
+     * Builder for submitting a lot of tasks at once.
+     *
+     * Tasks added to the batch are just linked together locally, so building it up doesn't touch any shared state.
+     * submit then links the whole chain into the loop's task queue with one atomic operation and rings the loop
+     * at most once. Anything left over when the batch is destroyed gets submitted then.
+     * */
+    class TaskBatch {
+        private:
+            std::shared_ptr<Loop> _loop;
+
+            Loop::priority _priority;
+
+            //Linked newest first, the same way the task queue expects it
+            detail::TaskNode *first, *last;
+
+            size_t count;
+
+            inline void add( detail::TaskNode *n ) noexcept {
+                n->next     = this->first;
+                this->first = n;
+
+                if( this->last == nullptr ) {
+                    this->last = n;
+                }
+
+                ++this->count;
+            }
+
+        public:
+            explicit inline TaskBatch( std::shared_ptr<Loop> l, Loop::priority p = Loop::priority::NORMAL ) noexcept
+                : _loop( std::move( l )), _priority( p ), first( nullptr ), last( nullptr ), count( 0 ) {
+            }
+
+            TaskBatch( const TaskBatch & ) = delete;
+
+            inline TaskBatch( TaskBatch &&other ) noexcept
+                : _loop( std::move( other._loop )), _priority( other._priority ),
+                  first( other.first ), last( other.last ), count( other.count ) {
+                other.first = other.last = nullptr;
+                other.count = 0;
+            }
+
+            template <typename Functor, typename... Args>
+            inline TaskBatch &post( Functor &&f, Args &&... args ) {
+                this->add( detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... ));
+
+                return *this;
+            }
+
+            template <typename Functor, typename... Args>
+            UV_DECLTYPE_AUTO schedule( Functor f, Args... args ) {
+                typedef detail::ScheduledContinuation<Functor, Loop> Cont;
+
+                Cont *c = new Cont( f );
+
+                auto ret = c->init( std::shared_ptr<Loop>( this->_loop ), std::forward<Args>( args )... );
+
+                this->add( c );
+
+                return ret;
+            }
+
+            inline size_t size() const noexcept {
+                return this->count;
+            }
+
+            inline bool empty() const noexcept {
+                return this->count == 0;
+            }
+
+            inline void submit() noexcept {
+                if( this->first != nullptr ) {
+                    this->_loop->enqueue( this->_priority, this->first, this->last, this->count );
+
+                    this->first = this->last = nullptr;
+                    this->count = 0;
+                }
+            }
+
+            //Same as submit, but also returns a future that is ready once every task in the batch has run
+            inline std::shared_future<void> submit_future() {
+                detail::BatchDone *b = new detail::BatchDone();
+
+                std::shared_future<void> done = b->done.get_future().share();
+
+                this->add( b );
+
+                this->submit();
+
+                return done;
+            }
+
+            ~TaskBatch() {
+                this->submit();
+            }
+    };
+
+    inline TaskBatch Loop::batch( priority p ) {
+        return TaskBatch( this->shared_from_this(), p );
+    }
+
+    template <typename Iterator>
+    std::shared_future<void> Loop::post_bulk( Iterator first, Iterator last ) {
+        TaskBatch b( this->shared_from_this());
+
+        for( ; first != last; ++first ) {
+            b.post( *first );
+        }
+
+        return b.submit_future();
+    }
+
     namespace detail {
         inline uv_loop_t *FromLoop::loop_handle() {
             return this->loop()->handle();
@@ -572,6 +2317,37 @@ namespace uv {
         return detail::default_loop;
     }
 
+    inline void Timer::start_timer( uv_timer_cb cb, uint64_t timeout, uint64_t repeat ) {
+        std::shared_ptr<Loop> l = this->loop();
+
+        if( l->virtual_clock ) {
+            uv_timer_stop( this->handle());
+
+            ++this->virtual_generation;
+
+            this->virtual_cb     = cb;
+            this->virtual_repeat = repeat;
+            this->virtual_active = true;
+
+            l->add_virtual_timer( this->shared_from_this(), l->virtual_now + timeout );
+
+        } else {
+            uv_timer_start( this->handle(), cb, timeout, repeat );
+        }
+    }
+
+    template <typename H, typename D>
+    template <typename Functor>
+    void HandleBase<H, D>::when_ready( Functor &&f ) {
+        if( this->ready ) {
+            f();
+
+        } else {
+            //post, not dispatch, since on the loop thread the initialization is still waiting in the queue
+            this->loop()->post( std::forward<Functor>( f ));
+        }
+    }
+
     template <typename H, typename D>
     template <typename Functor>
     std::shared_future<void> Handle<H, D>::close( Functor f ) {
@@ -606,6 +2382,9 @@ namespace uv {
                             data->template close_cont<Cont>()->dispatch();
 
                             data->close_continuation.reset();
+
+                            //Closed handles are of no use to the loop anymore
+                            self->unregister();
                         }
 
                     } else {
@@ -614,14 +2393,13 @@ namespace uv {
                 }
             };
 
-            if( this->on_loop_thread()) {
-                uv_close((uv_handle_t *)this->handle(), cb );
+            auto self = this->shared_from_this();
 
-            } else {
-                this->loop()->schedule( [this, cb] {
-                    uv_close((uv_handle_t *)this->handle(), cb );
+            this->when_ready( [self, cb] {
+                self->loop()->dispatch( [self, cb] {
+                    uv_close((uv_handle_t *)self->handle(), cb );
                 } );
-            }
+            } );
 
             return ret;
         }
@@ -631,6 +2409,21 @@ namespace uv {
     inline UV_DECLTYPE_AUTO schedule( std::shared_ptr<Loop> l, Args... args ) {
         return l->schedule( std::forward<Args>( args )... );
     }
+
+    template <typename... Args>
+    inline void post( std::shared_ptr<Loop> l, Args &&... args ) {
+        l->post( std::forward<Args>( args )... );
+    }
+
+    template <typename... Args>
+    inline void dispatch( std::shared_ptr<Loop> l, Args &&... args ) {
+        l->dispatch( std::forward<Args>( args )... );
+    }
+
+    template <typename... Args>
+    inline void defer( std::shared_ptr<Loop> l, Args &&... args ) {
+        l->defer( std::forward<Args>( args )... );
+    }
 }
 
 #ifdef UV_OVERLOAD_OSTREAM
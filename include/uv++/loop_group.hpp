@@ -0,0 +1,437 @@
+#ifndef UV_LOOP_GROUP_HPP
+#define UV_LOOP_GROUP_HPP
+
+#include "loop.hpp"
+
+#include "detail/work_stealing.hpp"
+
+#include <vector>
+#include <string>
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <sched.h>
+
+#endif
+
+//Most loop-agnostic tasks a loop runs in one go before giving its other callbacks a turn
+#ifndef UV_STEAL_SLICE
+#define UV_STEAL_SLICE 64
+#endif
+
+namespace uv {
+    /*
+     * A set of loops, each running on its own thread, for scaling past a single core.
+     *
+     * By default there is one loop per hardware thread, each pinned to its own core. The loops are created up front,
+     * so handles can be set up on them before start is called, same as with a lone Loop.
+     *
+     * Tasks given to spawn aren't tied to any one loop, so whichever loop is idle can steal them from a busy one.
+     * */
+    class LoopGroup {
+            friend class Strand;
+
+        public:
+            enum class placement {
+                    ROUND_ROBIN,
+                    LEAST_LOADED
+            };
+
+        private:
+            /*
+             * Per-loop state for loop-agnostic tasks.
+             *
+             * Tasks spawned from outside the group land in the inbox, which only the owning loop moves into its
+             * deque. Everything else in the group can steal from the deque. The worker itself is the task that gets
+             * queued onto its loop to run a pass, so waking a loop up never allocates.
+             * */
+            struct StealWorker : public detail::TaskNode {
+                LoopGroup *group;
+                size_t    index;
+
+                detail::TaskQueue         inbox;
+                detail::WorkStealingDeque deque;
+
+                //Whether a pass is already queued on the loop
+                std::atomic_bool scheduled;
+
+                std::atomic_size_t stolen;
+
+                inline StealWorker( LoopGroup *g, size_t i )
+                    : group( g ), index( i ), scheduled( false ), stolen( 0 ) {
+                    this->run = &StealWorker::run_pass;
+                }
+
+                static void run_pass( detail::TaskNode *n ) noexcept {
+                    StealWorker *w = static_cast<StealWorker *>(n);
+
+                    w->group->work( w );
+                }
+            };
+
+            std::vector<std::shared_ptr<Loop>> _loops;
+            std::vector<std::thread>           threads;
+            std::vector<int>                   cpus;
+
+            std::atomic_size_t next_loop;
+
+            bool pin;
+
+            std::vector<std::unique_ptr<StealWorker>> workers;
+
+            size_t steal_slice;
+
+            //The worker whose pass is running on this thread, if any
+            static StealWorker *&current_worker() noexcept {
+                static thread_local StealWorker *w = nullptr;
+
+                return w;
+            }
+
+            //Queues a pass on the worker's loop unless one is already queued
+            inline void wake( StealWorker *w ) noexcept {
+                if( !w->scheduled.exchange( true )) {
+                    this->_loops[w->index]->enqueue( Loop::priority::NORMAL, w );
+                }
+            }
+
+            //Wakes up idle siblings so they come and steal from w, at most one per task w can spare
+            void share( StealWorker *w ) noexcept {
+                size_t spare = w->deque.size();
+
+                for( size_t i = 1; i < this->workers.size() && spare > 1; ++i ) {
+                    StealWorker *sibling = this->workers[( w->index + i ) % this->workers.size()].get();
+
+                    if( !sibling->scheduled.load( std::memory_order_relaxed ) && !sibling->scheduled.exchange( true )) {
+                        this->_loops[sibling->index]->enqueue( Loop::priority::NORMAL, sibling );
+
+                        --spare;
+                    }
+                }
+            }
+
+            detail::TaskNode *steal_for( StealWorker *w ) noexcept {
+                for( size_t i = 1; i < this->workers.size(); ++i ) {
+                    StealWorker *victim = this->workers[( w->index + i ) % this->workers.size()].get();
+
+                    detail::TaskNode *task = victim->deque.steal();
+
+                    if( task != nullptr ) {
+                        w->stolen.fetch_add( 1, std::memory_order_relaxed );
+
+                        return task;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            //Hands a loop-agnostic task to the group. Used by spawn and by strands for their runners.
+            void submit( detail::TaskNode *task ) {
+                StealWorker *current = current_worker();
+
+                if( current != nullptr && current->group == this ) {
+                    current->deque.push( task );
+
+                } else {
+                    StealWorker *w = this->workers[this->next_loop.fetch_add( 1, std::memory_order_relaxed ) %
+                                                   this->workers.size()].get();
+
+                    w->inbox.push( task );
+
+                    this->wake( w );
+                }
+            }
+
+            /*
+             * A single pass on w's loop thread. Runs up to a slice of its own tasks, newest first, then steals from
+             * siblings if it runs dry. If there is still work left afterwards it queues itself again, so the loop
+             * gets to poll for I/O and run its other tasks in between slices.
+             * */
+            void work( StealWorker *w ) noexcept {
+                StealWorker *&current = current_worker();
+
+                current = w;
+
+                for( ;; ) {
+                    detail::TaskNode *task = w->inbox.take_all();
+
+                    while( task != nullptr ) {
+                        detail::TaskNode *next = task->next;
+
+                        w->deque.push( task );
+
+                        task = next;
+                    }
+
+                    size_t ran = 0;
+
+                    while( ran < this->steal_slice && ( task = w->deque.pop()) != nullptr ) {
+                        task->run( task );
+
+                        ++ran;
+                    }
+
+                    if( !w->deque.empty()) {
+                        this->share( w );
+
+                        break;
+                    }
+
+                    while( ran < this->steal_slice && ( task = this->steal_for( w )) != nullptr ) {
+                        task->run( task );
+
+                        ++ran;
+                    }
+
+                    //Stolen tasks can spawn more onto our own deque
+                    if( ran == this->steal_slice || !w->deque.empty()) {
+                        break;
+                    }
+
+                    /*
+                     * Out of work. Clear the flag before checking the inbox one last time, so a spawn that raced
+                     * with this either sees the flag cleared and wakes us, or gets picked up right here.
+                     * */
+                    w->scheduled.store( false );
+
+                    if( w->inbox.empty() || w->scheduled.exchange( true )) {
+                        current = nullptr;
+
+                        return;
+                    }
+                }
+
+                current = nullptr;
+
+                this->_loops[w->index]->enqueue( Loop::priority::NORMAL, w );
+            }
+
+            static void pin_thread( std::thread &t, int cpu ) noexcept {
+#ifdef __linux__
+                cpu_set_t set;
+
+                CPU_ZERO( &set );
+                CPU_SET( cpu, &set );
+
+                pthread_setaffinity_np( t.native_handle(), sizeof( cpu_set_t ), &set );
+#endif
+            }
+
+            static void name_thread( std::thread &t, const std::string &name ) noexcept {
+#ifdef __linux__
+                //Linux only allows 15 characters plus the null terminator
+                pthread_setname_np( t.native_handle(), name.substr( 0, 15 ).c_str());
+#endif
+            }
+
+        public:
+            //One loop per core, for each core given
+            explicit LoopGroup( std::vector<int> cores, bool pin_threads = true )
+                : cpus( std::move( cores )), next_loop( 0 ), pin( pin_threads ), steal_slice( UV_STEAL_SLICE ) {
+                if( this->cpus.empty()) {
+                    throw ::uv::Exception( "LoopGroup needs at least one loop" );
+                }
+
+                for( size_t i = 0; i < this->cpus.size(); ++i ) {
+                    this->_loops.push_back( Loop::make_loop());
+                    this->workers.emplace_back( new StealWorker( this, i ));
+                }
+            }
+
+            //n loops, pinned to cores 0 through n-1. Zero means one per hardware thread.
+            explicit LoopGroup( size_t n = 0, bool pin_threads = true )
+                : LoopGroup( LoopGroup::first_cores( n ), pin_threads ) {
+            }
+
+            LoopGroup( const LoopGroup & ) = delete;
+
+            static std::vector<int> first_cores( size_t n ) {
+                if( n == 0 ) {
+                    n = std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+                }
+
+                std::vector<int> cores( n );
+
+                for( size_t i = 0; i < n; ++i ) {
+                    cores[i] = (int)( i % std::max<size_t>( std::thread::hardware_concurrency(), 1 ));
+                }
+
+                return cores;
+            }
+
+            void start( Loop::run_mode mode = Loop::RUN_DEFAULT ) {
+                if( !this->threads.empty()) {
+                    throw ::uv::Exception( "LoopGroup already started" );
+                }
+
+                for( size_t i = 0; i < this->_loops.size(); ++i ) {
+                    std::shared_ptr<Loop> l = this->_loops[i];
+
+                    this->threads.emplace_back( [l, mode] {
+                        l->start( mode );
+                    } );
+
+                    if( this->pin ) {
+                        pin_thread( this->threads.back(), this->cpus[i] );
+                    }
+
+                    name_thread( this->threads.back(), "uv-loop-" + std::to_string( i ));
+                }
+            }
+
+            //Asks every loop to stop. Can be called from any thread, including one of the loop threads.
+            void stop() {
+                for( auto &l : this->_loops ) {
+                    l->post( []( std::shared_ptr<Loop> inner ) {
+                        inner->stop();
+                    }, l );
+                }
+            }
+
+            void join() {
+                for( auto &t : this->threads ) {
+                    if( t.joinable()) {
+                        t.join();
+                    }
+                }
+
+                this->threads.clear();
+            }
+
+            inline size_t size() const noexcept {
+                return this->_loops.size();
+            }
+
+            inline const std::vector<std::shared_ptr<Loop>> &loops() const noexcept {
+                return this->_loops;
+            }
+
+            inline std::shared_ptr<Loop> at( size_t i ) const {
+                return this->_loops.at( i );
+            }
+
+            inline std::shared_ptr<Loop> operator[]( size_t i ) const noexcept {
+                return this->_loops[i];
+            }
+
+            inline std::shared_ptr<Loop> next() noexcept {
+                return this->_loops[this->next_loop.fetch_add( 1, std::memory_order_relaxed ) % this->_loops.size()];
+            }
+
+            //The loop with the fewest scheduled tasks waiting on it
+            std::shared_ptr<Loop> least_loaded() const noexcept {
+                size_t best = 0, best_pending = this->_loops[0]->pending_tasks();
+
+                for( size_t i = 1; i < this->_loops.size() && best_pending != 0; ++i ) {
+                    size_t pending = this->_loops[i]->pending_tasks();
+
+                    if( pending < best_pending ) {
+                        best         = i;
+                        best_pending = pending;
+                    }
+                }
+
+                return this->_loops[best];
+            }
+
+            //Picks a loop for a new handle or task
+            inline std::shared_ptr<Loop> select( placement p = placement::ROUND_ROBIN ) noexcept {
+                return p == placement::LEAST_LOADED ? this->least_loaded() : this->next();
+            }
+
+            template <typename... Args>
+            inline UV_DECLTYPE_AUTO schedule( placement p, Args &&... args ) {
+                return this->select( p )->schedule( std::forward<Args>( args )... );
+            }
+
+            template <typename... Args>
+            inline void post( placement p, Args &&... args ) {
+                this->select( p )->post( std::forward<Args>( args )... );
+            }
+
+            /*
+             * Runs f( args... ) on whichever loop in the group gets to it first.
+             *
+             * The task must not touch any loop-specific handles, since it can be stolen by any loop. Like post,
+             * there is nowhere for exceptions to go.
+             *
+             * Spawning from inside a spawned task pushes straight onto the current loop's deque, which is about as
+             * cheap as it gets. From anywhere else, tasks are spread round robin.
+             * */
+            template <typename Functor, typename... Args>
+            inline void spawn( Functor &&f, Args &&... args ) {
+                this->submit( detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... ));
+            }
+
+            //Sets how many spawned tasks a loop runs per pass before letting the rest of the loop run
+            inline void steal_slice_size( size_t n ) noexcept {
+                this->steal_slice = std::max<size_t>( n, 1 );
+            }
+
+            //Total number of spawned tasks that ran on a loop other than the one they were given to
+            size_t steals() const noexcept {
+                size_t total = 0;
+
+                for( auto &w : this->workers ) {
+                    total += w->stolen.load( std::memory_order_relaxed );
+                }
+
+                return total;
+            }
+
+            /*
+             * The loops may outlive the group, since loops() hands them out, but they must not be running once it's
+             * destroyed. Any pass still queued on one of them is taken back out, since the worker is freed here.
+             * */
+            ~LoopGroup() {
+                if( !this->threads.empty()) {
+                    this->stop();
+                    this->join();
+                }
+
+                //Marked as scheduled, so tasks spawned while draining below don't queue the worker on its loop again
+                std::vector<bool> linked( this->workers.size());
+
+                for( size_t i = 0; i < this->workers.size(); ++i ) {
+                    linked[i] = this->workers[i]->scheduled.exchange( true );
+                }
+
+                /*
+                 * Spawned tasks don't belong to any loop, so rather than leaking whatever the loops didn't get to,
+                 * just run them here. They can spawn more as they go, so keep at it until everything is empty.
+                 * */
+                for( bool any = true; any; ) {
+                    any = false;
+
+                    for( auto &w : this->workers ) {
+                        detail::TaskNode *task = w->inbox.take_all();
+
+                        while( task != nullptr ) {
+                            detail::TaskNode *next = task->next;
+
+                            task->run( task );
+
+                            task = next;
+                            any  = true;
+                        }
+
+                        while(( task = w->deque.pop()) != nullptr ) {
+                            task->run( task );
+
+                            any = true;
+                        }
+                    }
+                }
+
+                for( size_t i = 0; i < this->workers.size(); ++i ) {
+                    if( linked[i] ) {
+                        this->_loops[i]->unlink_task( this->workers[i].get());
+                    }
+                }
+            }
+    };
+}
+
+#endif //UV_LOOP_GROUP_HPP
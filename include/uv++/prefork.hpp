@@ -0,0 +1,244 @@
+#ifndef UV_PREFORK_HPP
+#define UV_PREFORK_HPP
+
+#include "loop.hpp"
+
+#ifndef _WIN32
+
+#include <functional>
+#include <vector>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+//Children that exit sooner than this after being started are only restarted after UV_PREFORK_BACKOFF
+#ifndef UV_PREFORK_MIN_UPTIME
+#define UV_PREFORK_MIN_UPTIME 1s
+#endif
+
+#ifndef UV_PREFORK_BACKOFF
+#define UV_PREFORK_BACKOFF 1s
+#endif
+
+namespace uv {
+    /*
+     * Forks a fixed number of worker processes off of a loop that has already been set up, such as with a listening
+     * socket, and keeps them running.
+     *
+     * Each child calls Loop::after_fork before anything else, then runs the given function with the loop and its
+     * worker index, and exits with whatever it returns. The parent is left to supervise, restarting any child that
+     * exits until stop is called. Children that keep dying right away are restarted with a delay, so a broken
+     * worker doesn't turn into a fork bomb.
+     *
+     * Fork only copies the calling thread, so start has to be called from the loop thread while the loop isn't
+     * running, and before creating any LoopGroup or Watchdog on it.
+     *
+     * supervise reaps every child of the process, so don't spawn other processes from the parent while it's
+     * running.
+     * */
+    class Prefork {
+        public:
+            typedef std::function<int( std::shared_ptr<Loop>, size_t )> child_t;
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            std::shared_ptr<Loop> _loop;
+
+            child_t child_main;
+
+            //-1 for slots that don't have a running child. Atomic so stop can read them from anywhere.
+            std::vector<std::atomic<pid_t>> pids;
+            std::vector<clock::time_point>  started;
+
+            std::atomic_bool   stopping;
+            std::atomic_int    stop_signal;
+            std::atomic_size_t _restarts;
+
+            void spawn( size_t index ) {
+                //Otherwise anything still buffered would get written out by the parent and every child
+                fflush( nullptr );
+
+                pid_t pid = ::fork();
+
+                if( pid < 0 ) {
+                    //libuv error codes are negated errno values on unix
+                    throw ::uv::Exception( -errno );
+
+                } else if( pid == 0 ) {
+                    int code = 1;
+
+                    try {
+                        this->_loop->after_fork();
+
+                        code = this->child_main( this->_loop, index );
+
+                    } catch( ... ) {
+                    }
+
+                    fflush( nullptr );
+
+                    //Skip the parent's atexit handlers and static destructors
+                    _exit( code );
+                }
+
+                this->pids[index]    = pid;
+                this->started[index] = clock::now();
+
+                /*
+                 * stop might have gone through the pids just before this one was stored. It sets stopping before
+                 * reading them and this stores the pid before reading stopping, so at least one side sees the other.
+                 * */
+                if( this->stopping ) {
+                    ::kill( pid, this->stop_signal );
+                }
+            }
+
+            inline size_t find( pid_t pid ) const noexcept {
+                for( size_t i = 0; i < this->pids.size(); ++i ) {
+                    if( this->pids[i] == pid ) {
+                        return i;
+                    }
+                }
+
+                return this->pids.size();
+            }
+
+            inline bool any_running() const noexcept {
+                for( const std::atomic<pid_t> &p : this->pids ) {
+                    if( p > 0 ) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+        public:
+            Prefork( std::shared_ptr<Loop> l, size_t workers, child_t f )
+                : _loop( std::move( l )),
+                  child_main( std::move( f )),
+                  pids( workers ),
+                  started( workers ),
+                  stopping( false ),
+                  stop_signal( SIGTERM ),
+                  _restarts( 0 ) {
+                if( workers == 0 ) {
+                    throw ::uv::Exception( "Prefork needs at least one worker" );
+                }
+
+                if( !this->child_main ) {
+                    throw ::uv::Exception( "Prefork needs a function for the children to run" );
+                }
+
+                for( std::atomic<pid_t> &p : this->pids ) {
+                    p = -1;
+                }
+            }
+
+            Prefork( const Prefork & ) = delete;
+
+            //Forks every worker. Only returns in the parent.
+            void start() {
+                assert( this->_loop->on_loop_thread());
+
+                for( size_t i = 0; i < this->pids.size(); ++i ) {
+                    this->spawn( i );
+                }
+            }
+
+            /*
+             * Blocks waiting on the children, restarting any that exit, until stop has been called and all of them
+             * are gone.
+             * */
+            void supervise() {
+                using namespace std::chrono_literals;
+
+                while( this->any_running()) {
+                    int   status;
+                    pid_t pid = ::waitpid( -1, &status, 0 );
+
+                    if( pid < 0 ) {
+                        if( errno == EINTR ) {
+                            continue;
+                        }
+
+                        //ECHILD, so nothing is left to wait on
+                        break;
+                    }
+
+                    size_t i = this->find( pid );
+
+                    if( i == this->pids.size()) {
+                        continue;
+                    }
+
+                    this->pids[i] = -1;
+
+                    if( this->stopping ) {
+                        continue;
+                    }
+
+                    if( clock::now() - this->started[i] < UV_PREFORK_MIN_UPTIME ) {
+                        std::this_thread::sleep_for( UV_PREFORK_BACKOFF );
+
+                        if( this->stopping ) {
+                            continue;
+                        }
+                    }
+
+                    this->spawn( i );
+
+                    ++this->_restarts;
+                }
+            }
+
+            /*
+             * Stops restarting children and sends sig to all of them. Only uses atomics and kill, so it's fine to
+             * call from another thread or a signal handler.
+             * */
+            void stop( int sig = SIGTERM ) noexcept {
+                this->stop_signal = sig;
+                this->stopping    = true;
+
+                for( std::atomic<pid_t> &p : this->pids ) {
+                    pid_t pid = p;
+
+                    if( pid > 0 ) {
+                        ::kill( pid, sig );
+                    }
+                }
+            }
+
+            inline size_t workers() const noexcept {
+                return this->pids.size();
+            }
+
+            //Current pid of each worker, or -1 where one isn't running
+            std::vector<pid_t> children() const {
+                std::vector<pid_t> out;
+
+                for( const std::atomic<pid_t> &p : this->pids ) {
+                    out.push_back( p );
+                }
+
+                return out;
+            }
+
+            //Children restarted after exiting on their own
+            inline size_t restarts() const noexcept {
+                return this->_restarts;
+            }
+
+            inline std::shared_ptr<Loop> loop() const noexcept {
+                return this->_loop;
+            }
+    };
+}
+
+#endif //_WIN32
+
+#endif //UV_PREFORK_HPP
@@ -10,6 +10,7 @@
 #include "../detail/async.hpp"
 
 #include "../detail/data.hpp"
+#include "../detail/registry.hpp"
 
 #include <atomic>
 
@@ -87,12 +88,21 @@ namespace uv {
                 REQUEST_FINISHED  = ( 1 << 3 )
             };
 
+            friend class Loop;
+
         protected:
             std::shared_ptr<RequestData> internal_data;
 
             std::shared_ptr<request_t> _request;
             std::atomic_int            _status;
 
+            //Link into the owning loop's registry
+            detail::RegistryHook registry_hook;
+
+            inline void unregister() noexcept {
+                this->registry_hook.unlink();
+            }
+
             //Implemented in derived classes
             virtual void _init() = 0;
 
@@ -114,15 +124,34 @@ namespace uv {
             }
 
             inline void init( std::shared_ptr<Loop> l ) {
+                this->attach( l );
+
+                this->_init();
+            }
+
+            //Same split as HandleBase, so Loop::new_handle can treat them the same way
+            inline void attach( std::shared_ptr<Loop> l ) {
                 this->_loop_init( l );
 
                 this->internal_data = std::make_shared<RequestData>( std::static_pointer_cast<derived_type>( this->shared_from_this()), this->_request );
 
                 this->handle()->data = new std::weak_ptr<RequestData>( this->internal_data );
+            }
+
+            template <typename... Args>
+            inline void pre_start( Args &&... ) noexcept {
+            }
+
+            inline void init_on_loop() {
+                assert( this->on_loop_thread());
 
                 this->_init();
             }
 
+            inline void mark_ready() noexcept {
+                //Requests don't do anything on the loop until they're queued, so there is nothing to wait for
+            }
+
             inline std::shared_future<void> cancel() {
                 if( this->on_loop_thread()) {
                     if( this->_status == REQUEST_ACTIVE ) {
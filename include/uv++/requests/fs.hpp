@@ -88,12 +88,7 @@ namespace uv {
                         } );
                     };
 
-                    if( this->on_loop_thread()) {
-                        cb( std::forward<Args>( args )... );
-
-                    } else {
-                        schedule( this->loop(), cb, std::forward<Args>( args )... );
-                    }
+                    dispatch( this->loop(), cb, std::forward<Args>( args )... );
 
                     return r->get_future();
                 }
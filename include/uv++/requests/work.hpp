@@ -90,6 +90,13 @@ namespace uv {
                     if( d != nullptr ) {
                         if( auto data = d->lock()) {
                             if( auto self = data->self.lock()) {
+                                /*
+                                 * Finished, so the loop can let go of it. It's registered again if it's queued again,
+                                 * which can happen as soon as the status or the future below let anyone know it's done,
+                                 * so this has to come first or it would undo the new registration.
+                                 * */
+                                self->unregister();
+
                                 int expect_active = REQUEST_ACTIVE;
 
                                 self->_status.compare_exchange_strong( expect_active, REQUEST_FINISHED );
@@ -148,25 +155,21 @@ namespace uv {
                 } else {
                     auto c = std::make_shared<Cont>( f );
 
-                    auto result = *c->s;
-
-                    c->init( this->shared_from_this(), std::forward<Args>( args )... );
+                    auto result = c->init( std::static_pointer_cast<Work>( this->shared_from_this()), std::forward<Args>( args )... );
 
                     this->internal_data->continuation = c;
 
-                    if( last_status != REQUEST_PENDING ) {
-                        if( !this->on_loop_thread()) {
-                            schedule( this->loop(), [this] {
-                                this->do_queue<Cont>();
-                            } );
+                    //Keeps the request alive while it's queued, even if nothing else holds onto it
+                    detail::Registry::reinsert( &this->registry_hook, this->shared_from_this());
 
-                        } else {
+                    if( last_status != REQUEST_PENDING ) {
+                        dispatch( this->loop(), [this] {
                             this->do_queue<Cont>();
-                        }
+                        } );
                     }
 
                     //I love this line. So succinct.
-                    return util::then( c->finished, [result] { return result; }, UV_ASYNC_LAUNCH );
+                    return util::then( c->finished, [result] { return result.get(); }, UV_ASYNC_LAUNCH );
                 }
             }
 
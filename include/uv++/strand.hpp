@@ -0,0 +1,177 @@
+#ifndef UV_STRAND_HPP
+#define UV_STRAND_HPP
+
+#include "loop_group.hpp"
+
+#include <functional>
+
+//Most tasks a strand runs before handing its loop back to the group
+#ifndef UV_STRAND_SLICE
+#define UV_STRAND_SLICE 64
+#endif
+
+//Default number of strands in a Strands set
+#ifndef UV_STRAND_SHARDS
+#define UV_STRAND_SHARDS 256
+#endif
+
+namespace uv {
+    /*
+     * Serial executor on top of a LoopGroup.
+     *
+     * Tasks posted to the same strand run one at a time and in the order they were posted, but not necessarily
+     * on the same loop, so they can't touch loop-specific handles. Different strands run in parallel.
+     *
+     * There are no locks. Posting pushes onto a lock-free queue and bumps a counter, and whoever bumps it from
+     * zero hands the strand's runner to the group as a task. That runner keeps going until it has run everything
+     * counted, so there is never more than one runner for a strand at a time.
+     *
+     * The group has to outlive the strand. A strand destroyed with tasks still pending leaves them to its runner,
+     * which frees itself once it has caught up.
+     * */
+    class Strand {
+        private:
+            struct Runner : public detail::TaskNode {
+                LoopGroup *group;
+
+                detail::TaskQueue queue;
+
+                //Posted tasks not yet run. Whoever takes this off zero schedules the runner.
+                std::atomic_size_t pending;
+
+                //Tasks already taken off the queue. Only touched by the runner.
+                detail::TaskNode *backlog;
+
+                //Set by the last task of a destroyed strand. Only touched by the runner.
+                bool released;
+
+                explicit Runner( LoopGroup *g ) noexcept
+                    : group( g ), pending( 0 ), backlog( nullptr ), released( false ) {
+                    this->run = &Runner::run_slice;
+                }
+
+                static void run_slice( detail::TaskNode *n ) noexcept {
+                    static_cast<Runner *>(n)->run_tasks();
+                }
+
+                void run_tasks() noexcept {
+                    for( size_t ran = 0; ran < UV_STRAND_SLICE; ++ran ) {
+                        if( this->backlog == nullptr ) {
+                            this->backlog = this->queue.take_all();
+                        }
+
+                        //Counted tasks have always been pushed already
+                        assert( this->backlog != nullptr );
+
+                        detail::TaskNode *task = this->backlog;
+
+                        this->backlog = task->next;
+
+                        task->run( task );
+
+                        //Once pending hits zero, this may be freed by the strand at any moment
+                        const bool last = this->released;
+
+                        if( this->pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+                            if( last ) {
+                                delete this;
+                            }
+
+                            return;
+                        }
+                    }
+
+                    //Let everything else on this loop have a turn, and maybe move to a less busy one
+                    this->group->submit( this );
+                }
+
+                inline void push( detail::TaskNode *task ) {
+                    this->queue.push( task );
+
+                    if( this->pending.fetch_add( 1, std::memory_order_acq_rel ) == 0 ) {
+                        this->group->submit( this );
+                    }
+                }
+            };
+
+            Runner *runner;
+
+        public:
+            explicit Strand( LoopGroup &g )
+                : runner( new Runner( &g )) {
+            }
+
+            Strand( const Strand & ) = delete;
+
+            template <typename Functor, typename... Args>
+            inline void post( Functor &&f, Args &&... args ) {
+                this->runner->push( detail::make_posted_task( std::forward<Functor>( f ), std::forward<Args>( args )... ));
+            }
+
+            inline size_t pending_tasks() const noexcept {
+                return this->runner->pending.load( std::memory_order_relaxed );
+            }
+
+            inline bool idle() const noexcept {
+                return this->pending_tasks() == 0;
+            }
+
+            ~Strand() {
+                Runner *r = this->runner;
+
+                if( r->pending.load( std::memory_order_acquire ) == 0 ) {
+                    delete r;
+
+                } else {
+                    //The runner might be queued on the group right now, so it has to free itself after the rest
+                    r->push( detail::make_posted_task( [r] {
+                        r->released = true;
+                    } ));
+                }
+            }
+    };
+
+    /*
+     * Fixed set of strands picked by hashing a key, for per-key ordering (per session, per connection, etc.) without
+     * creating a strand for every key.
+     *
+     * Tasks for the same key always land on the same strand. Different keys usually run in parallel, but can end up
+     * sharing a strand and being serialized with each other, so more shards means fewer false collisions.
+     * */
+    template <typename Key, typename Hash = std::hash<Key>>
+    class Strands {
+        private:
+            std::vector<std::unique_ptr<Strand>> strands;
+
+            Hash hasher;
+
+        public:
+            explicit Strands( LoopGroup &g, size_t shards = UV_STRAND_SHARDS, Hash h = Hash())
+                : hasher( std::move( h )) {
+                if( shards == 0 ) {
+                    throw ::uv::Exception( "Strands needs at least one shard" );
+                }
+
+                for( size_t i = 0; i < shards; ++i ) {
+                    this->strands.emplace_back( new Strand( g ));
+                }
+            }
+
+            Strands( const Strands & ) = delete;
+
+            inline Strand &operator[]( const Key &key ) noexcept {
+                return *this->strands[this->hasher( key ) % this->strands.size()];
+            }
+
+            template <typename Functor, typename... Args>
+            inline void post( const Key &key, Functor &&f, Args &&... args ) {
+                ( *this )[key].post( std::forward<Functor>( f ), std::forward<Args>( args )... );
+            }
+
+            inline size_t size() const noexcept {
+                return this->strands.size();
+            }
+    };
+}
+
+#endif //UV_STRAND_HPP
@@ -0,0 +1,396 @@
+#ifndef UV_WATCHDOG_HPP
+#define UV_WATCHDOG_HPP
+
+#include "loop.hpp"
+#include "handles/prepare.hpp"
+#include "handles/check.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(__GLIBC__)
+
+#include <execinfo.h>
+#include <cstring>
+#include <pthread.h>
+#include <signal.h>
+
+#define UV_WATCHDOG_BACKTRACE
+
+#endif
+
+//Signal used to interrupt a stalled loop thread and grab its backtrace
+#ifndef UV_WATCHDOG_SIGNAL
+#define UV_WATCHDOG_SIGNAL SIGURG
+#endif
+
+//Deepest backtrace captured from a stalled loop thread
+#ifndef UV_WATCHDOG_FRAMES
+#define UV_WATCHDOG_FRAMES 64
+#endif
+
+namespace uv {
+    /*
+     * Watches a loop from its own thread and reports when a single iteration takes longer than the threshold,
+     * which almost always means something is blocking the loop thread.
+     *
+     * The loop side is just a counter bumped from a Prepare and Check handle. Only once a whole check interval has
+     * gone by without a heartbeat does the watchdog poke the loop with a task, so an idle loop sitting in poll or
+     * parked doesn't look stalled, while a busy one is never woken up for it. Both handles are unreferenced, so they
+     * don't keep the loop alive by themselves.
+     *
+     * The hook is called on the watchdog thread once when a stall is detected, and again when it ends. With glibc
+     * on Linux, the first report also has a backtrace of the loop thread, which is interrupted with
+     * UV_WATCHDOG_SIGNAL to get it. Blocking system calls on the loop thread might see EINTR because of that.
+     *
+     * The signal handler is installed process-wide the first time a Watchdog is made. Whatever handler was there
+     * before is kept and still gets every UV_WATCHDOG_SIGNAL the watchdog didn't send itself, so SIGURG for
+     * out-of-band socket data keeps working. Handlers installed over it later are on their own, though.
+     *
+     * The watchdog doesn't know when the loop has been stopped on purpose, so destroy it first.
+     * */
+    class Watchdog {
+        public:
+            struct Stall {
+                //How long the loop has been stuck so far, or in total once it has recovered
+                std::chrono::nanoseconds duration;
+
+                bool ongoing;
+
+                //Heartbeat count when the loop got stuck
+                uint64_t beat;
+
+                //Loop::running_task at the time of detection, and whatever symbol it resolves to
+                const void  *task;
+                std::string task_name;
+
+                std::vector<std::string> backtrace;
+            };
+
+            typedef std::function<void( const Stall & )> hook_t;
+
+        private:
+            struct State {
+                std::atomic<uint64_t> beats;
+
+                //Whether a poke is already waiting on the loop
+                std::atomic_bool poking;
+
+                std::shared_ptr<Prepare> prepare;
+                std::shared_ptr<Check>   check;
+
+#ifdef UV_WATCHDOG_BACKTRACE
+                std::atomic_bool have_thread;
+                pthread_t        thread;
+#endif
+
+                inline State() noexcept
+                    : beats( 0 ), poking( false ) {
+#ifdef UV_WATCHDOG_BACKTRACE
+                    this->have_thread = false;
+#endif
+                }
+
+                //Only ever called on the loop thread, so it doesn't need a locked increment
+                inline void beat() noexcept {
+                    this->beats.store( this->beats.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                }
+
+                /*
+                 * Heartbeat from the prepare and check handles and from pokes. The first one also records which
+                 * thread the loop is actually running on, which isn't known until it runs.
+                 * */
+                inline void loop_beat() noexcept {
+#ifdef UV_WATCHDOG_BACKTRACE
+                    if( !this->have_thread.load( std::memory_order_relaxed )) {
+                        this->thread = pthread_self();
+
+                        this->have_thread.store( true, std::memory_order_release );
+                    }
+#endif
+
+                    this->beat();
+                }
+            };
+
+            std::shared_ptr<Loop>  _loop;
+            std::shared_ptr<State> state;
+
+            std::chrono::nanoseconds threshold;
+
+            hook_t hook;
+
+            std::mutex              m;
+            std::condition_variable cv;
+            bool                    stopping;
+
+            std::thread thread;
+
+#ifdef UV_WATCHDOG_BACKTRACE
+            struct Capture {
+                void             *frames[UV_WATCHDOG_FRAMES];
+                std::atomic_int  depth;
+            };
+
+            static std::atomic<Capture *> &capture_target() noexcept {
+                static std::atomic<Capture *> target( nullptr );
+
+                return target;
+            }
+
+            static std::mutex &capture_mutex() noexcept {
+                static std::mutex m;
+
+                return m;
+            }
+
+            //Whatever handled UV_WATCHDOG_SIGNAL before the watchdog took it over
+            static struct sigaction &previous_action() noexcept {
+                static struct sigaction previous;
+
+                return previous;
+            }
+
+            static void on_capture_signal( int sig, siginfo_t *info, void *context ) {
+                Capture *c = capture_target().load( std::memory_order_acquire );
+
+                if( c != nullptr ) {
+                    c->depth.store( ::backtrace( c->frames, UV_WATCHDOG_FRAMES ), std::memory_order_release );
+
+                } else {
+                    //Not one of ours, so pass it on as if the watchdog had never been installed
+                    const struct sigaction &previous = previous_action();
+
+                    if( previous.sa_flags & SA_SIGINFO ) {
+                        if( previous.sa_sigaction != nullptr ) {
+                            previous.sa_sigaction( sig, info, context );
+                        }
+
+                    } else if( previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN &&
+                               previous.sa_handler != nullptr ) {
+                        previous.sa_handler( sig );
+                    }
+                }
+            }
+
+            static void install_capture_handler() {
+                static std::once_flag once;
+
+                std::call_once( once, [] {
+                    //The first call to backtrace can allocate, which must not happen inside the signal handler
+                    void *warmup[1];
+
+                    ::backtrace( warmup, 1 );
+
+                    struct sigaction sa;
+
+                    memset( &sa, 0, sizeof( sa ));
+
+                    sa.sa_sigaction = &Watchdog::on_capture_signal;
+                    sa.sa_flags     = SA_RESTART | SA_SIGINFO;
+
+                    sigemptyset( &sa.sa_mask );
+
+                    sigaction( UV_WATCHDOG_SIGNAL, &sa, &previous_action());
+                } );
+            }
+
+            static std::vector<std::string> symbolize( void *const *frames, int depth ) {
+                std::vector<std::string> names;
+
+                if( depth > 0 ) {
+                    char **symbols = ::backtrace_symbols( frames, depth );
+
+                    if( symbols != nullptr ) {
+                        names.assign( symbols, symbols + depth );
+
+                        free( symbols );
+                    }
+                }
+
+                return names;
+            }
+
+            std::vector<std::string> capture_backtrace() {
+                if( !this->state->have_thread.load( std::memory_order_acquire )) {
+                    return {};
+                }
+
+                std::lock_guard<std::mutex> lock( capture_mutex());
+
+                //Static so a handler that runs late, after we've given up on it, still writes somewhere valid
+                static Capture c;
+
+                c.depth = -1;
+
+                capture_target().store( &c, std::memory_order_release );
+
+                if( pthread_kill( this->state->thread, UV_WATCHDOG_SIGNAL ) == 0 ) {
+                    for( int i = 0; i < 100 && c.depth.load( std::memory_order_acquire ) < 0; ++i ) {
+                        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ));
+                    }
+                }
+
+                capture_target().store( nullptr, std::memory_order_release );
+
+                return symbolize( c.frames, std::max( c.depth.load( std::memory_order_acquire ), 0 ));
+            }
+#endif
+
+            void report( std::chrono::nanoseconds duration, bool ongoing, uint64_t beat, const void *task ) {
+                Stall s;
+
+                s.duration = duration;
+                s.ongoing  = ongoing;
+                s.beat     = beat;
+                s.task     = task;
+
+#ifdef UV_WATCHDOG_BACKTRACE
+                if( task != nullptr ) {
+                    void *frame = const_cast<void *>(task);
+
+                    std::vector<std::string> name = symbolize( &frame, 1 );
+
+                    if( !name.empty()) {
+                        s.task_name = name[0];
+                    }
+                }
+
+                if( ongoing ) {
+                    s.backtrace = this->capture_backtrace();
+                }
+#endif
+
+                this->hook( s );
+            }
+
+            void watch() {
+                typedef std::chrono::steady_clock clock;
+
+                //Check a few times per threshold, so a stall is caught reasonably close to when it crosses it
+                const std::chrono::nanoseconds interval = std::max( this->threshold / 4, std::chrono::nanoseconds( 1000000 ));
+
+                uint64_t          last    = this->state->beats.load( std::memory_order_relaxed );
+                clock::time_point since   = clock::now();
+                bool              stalled = false;
+
+                std::unique_lock<std::mutex> lock( this->m );
+
+                while( !this->cv.wait_for( lock, interval, [this] { return this->stopping; } )) {
+                    //The hook can take as long as it likes, so don't hold up the destructor on the lock meanwhile
+                    lock.unlock();
+
+                    uint64_t          b   = this->state->beats.load( std::memory_order_relaxed );
+                    clock::time_point now = clock::now();
+
+                    if( b != last ) {
+                        if( stalled ) {
+                            this->report( now - since, false, last, nullptr );
+
+                            stalled = false;
+                        }
+
+                        last  = b;
+                        since = now;
+
+                    } else {
+                        //Nothing has beat yet if the loop hasn't started, which isn't a stall
+                        if( !stalled && b != 0 && now - since >= this->threshold ) {
+                            stalled = true;
+
+                            this->report( now - since, true, b, this->_loop->running_task());
+                        }
+
+                        //Quiet for a whole interval, so make sure an idle loop comes out of poll or parking to beat
+                        if( !this->state->poking.exchange( true )) {
+                            std::shared_ptr<State> s = this->state;
+
+                            this->_loop->post( [s] {
+                                s->loop_beat();
+
+                                s->poking = false;
+                            } );
+                        }
+                    }
+
+                    lock.lock();
+                }
+            }
+
+        public:
+            template <typename _Rep, typename _Period>
+            Watchdog( std::shared_ptr<Loop> l, const std::chrono::duration<_Rep, _Period> &stall_threshold, hook_t h )
+                : _loop( std::move( l )),
+                  state( std::make_shared<State>()),
+                  threshold( std::chrono::duration_cast<std::chrono::nanoseconds>( stall_threshold )),
+                  hook( std::move( h )),
+                  stopping( false ) {
+                if( !this->hook ) {
+                    throw ::uv::Exception( "Watchdog needs a hook to report to" );
+                }
+
+#ifdef UV_WATCHDOG_BACKTRACE
+                install_capture_handler();
+#endif
+
+                std::shared_ptr<State> s = this->state;
+
+                this->_loop->dispatch( [s]( std::shared_ptr<Loop> inner ) {
+                    //The state owns both handles, so they can't hold on to it
+                    std::weak_ptr<State> w = s;
+
+                    s->prepare = inner->prepare( [w] {
+                        if( auto state = w.lock()) {
+                            state->loop_beat();
+                        }
+                    } );
+
+                    s->check = inner->check( [w] {
+                        if( auto state = w.lock()) {
+                            state->loop_beat();
+                        }
+                    } );
+
+                    s->prepare->unref();
+                    s->check->unref();
+                }, this->_loop );
+
+                this->thread = std::thread( &Watchdog::watch, this );
+            }
+
+            Watchdog( const Watchdog & ) = delete;
+
+            inline std::shared_ptr<Loop> loop() const noexcept {
+                return this->_loop;
+            }
+
+            //Total heartbeats so far, which is roughly two per loop iteration
+            inline uint64_t beats() const noexcept {
+                return this->state->beats.load( std::memory_order_relaxed );
+            }
+
+            ~Watchdog() {
+                {
+                    std::lock_guard<std::mutex> lock( this->m );
+
+                    this->stopping = true;
+                }
+
+                this->cv.notify_one();
+
+                this->thread.join();
+
+                std::shared_ptr<State> s = this->state;
+
+                this->_loop->dispatch( [s] {
+                    if( s->prepare ) {
+                        s->prepare->close( [] {} );
+                        s->check->close( [] {} );
+                    }
+                } );
+            }
+    };
+}
+
+#endif //UV_WATCHDOG_HPP